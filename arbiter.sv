@@ -1,32 +1,28 @@
 module arbiter
 	#(
 		//Memory bus constants
-		BUS_DATA_WIDTH = 64,
+		BUS_DATA_WIDTH = 64,		//64, 128, 256 or 512
 		BUS_TAG_WIDTH = 13,
-		DATA_LENGTH = 512,
+		LINE_BEATS = 512 / BUS_DATA_WIDTH,	//beats per 64-byte line
 
-		//State values
-		INITIAL = 0,
-		ACCEPT = 1,
-		ACKPROC = 2,
+		//Request channel states
+		IDLE = 0,		//free, pick a port
+		ADDR = 1,		//address sent, waiting for the ack
+		DATA = 2,		//sending the data beats of a write
 
-		//write states
-		READVAL = 3,
-		ACKVAL = 4,
-		DRAMWREQ = 5,
-		DRAMWRT = 6,
+		//Scheduling policy, used when both ports have a request
+		RR = 0,			//round-robin
+		DATA_FIRST = 1,		//memory access port first
+		AGE = 2,		//the request that has waited longer first
+		POLICY = RR,
 
-		//read states
-		DRAMRD = 7,
-		RECEIVE = 8,
-		RESPOND = 9,
-		RESPACK = 10,
-		SETRESPZ = 11
+		//tag bit set by the arbiter so responses can be routed back to the port that asked
+		PORT_TAG_BIT = 1
 	)
 	(
 		input  clk,
 		input reset,
-                output ready, // 1 if the arbiter is ready to receive req.
+                output ready, // 1 if no transaction is in flight.
 
 		//input 1 (instruction fetch)
 		input reqcyc0,
@@ -61,273 +57,265 @@ module arbiter
 		input [BUS_TAG_WIDTH-1:0] bus_resptag       //determine read/write
 	);
 
-	//variables to store information
-	logic [63:0] req_addr;
-	logic [63:0] _req_addr;
-	logic [12:0] req_tag;
-	logic [12:0] _req_tag;
-	logic [3:0] state;
-	logic [3:0] next_state;
-	logic [DATA_LENGTH-1:0] content;
-	logic [DATA_LENGTH-1:0] _content;
-	logic [8:0] ptr;
-	logic [8:0] next_ptr;
-	logic channel;
-	logic _channel;
+	//The request and response channels are independent: while one port's
+	//response is coming back, the other port can send its request.
+	//Requests and responses are passed through without buffering the line.
+	//With the L2, a second read goes to another L2 bank while the first one waits for DRAM.
 
-	//NOTE: multiple always comb blocks used to keep verilator happy
-	//  processor resp, ack, and cyc variables cannot be set or used within the same block
-   
-	//accept requests and values from the processor: INITIAL, ACCEPT, READVAL
-	always_comb begin
-		_channel = channel;
-		ready = 0;
-		case(state)
-			INITIAL: begin
-					//Initialize the system
-					next_state = ACCEPT;
-				end
-			ACCEPT: begin
-					//wait for requests from the processor
-					ready = 1;
-					_content = 0;
-					//receiving requeston on channel 0
-					if(reqcyc0 == 1) begin
-						_req_addr = req0;
-						_req_tag = reqtag0;
-						_channel = 0;
-						next_ptr = 0;
-						next_state = ACKPROC;
-					end
+	//request channel
+	logic [1:0] req_state;
+	logic [1:0] _req_state;
+	logic owner;		//port that has the request channel
+	logic _owner;
+	logic grant;		//port that gets the request channel this cycle
+	logic last_grant;	//for round-robin
+	logic _last_grant;
+	logic [8:0] wptr;	//data beats sent for the current write
+	logic [8:0] _wptr;
+	logic want0;		//port has a request that can go now
+	logic want1;
 
-					//receiving requests on channel 1
-					else if(reqcyc1 == 1) begin
-						_req_addr = req1;
-						_req_tag = reqtag1;
-						_channel = 1;
-						next_ptr = 0;
-						next_state = ACKPROC;
-					end
+	//response channel
+	logic [8:0] rptr0;	//beats of the port's response delivered (each port counts its own,
+	logic [8:0] _rptr0;	//so it doesn't matter if responses to the two ports come interleaved)
+	logic [8:0] rptr1;
+	logic [8:0] _rptr1;
+	logic resp_channel;
+	logic resp_valid;
+	logic pending0;		//port has a read in flight
+	logic pending1;
+	logic [63:0] pending_addr0;
+	logic [63:0] pending_addr1;
+	logic set_pending0;
+	logic set_pending1;
+	logic clear_pending0;
+	logic clear_pending1;
 
-					//else loop
-					else begin
-						next_state = ACCEPT;
-					end
-
-				end
-			READVAL: begin
-					//read value to be written from processor
-					//read value from channel 0
-					if(channel == 0) begin
-						if(reqcyc0 == 1) begin
-							_content[64*ptr +: 64] = req0;
-							next_state = ACKVAL;
-						end
-						else begin
-							next_state = READVAL;
-						end
-					end
-
-					//read value from channel 1
-					else if(channel == 1) begin
-						if(reqcyc1 == 1) begin
-							_content[64*ptr +: 64] = req1;
-							next_state = ACKVAL;
-						end
-						else begin
-							next_state = READVAL;
-						end
-					end
-				end
-		endcase
-	end
+	//queueing delay
+	logic [31:0] age0;	//cycles the current request of the port has waited
+	logic [31:0] age1;
+	logic [63:0] wait_cycles0;
+	logic [63:0] wait_cycles1;
+	logic [63:0] requests0;
+	logic [63:0] requests1;
+	logic count_req0;
+	logic count_req1;
 
+	//NOTE: multiple always comb blocks used to keep verilator happy
+	//  processor resp, ack, and cyc variables cannot be set or used within the same block
 
-	//acknowledge receiving request and values from processor: ACKPROC, ACKVAL
+	//pick a port and pass its request through: IDLE, ADDR, DATA
 	always_comb begin
+		_req_state = req_state;
+		_owner = owner;
+		_last_grant = last_grant;
+		_wptr = wptr;
+		bus_reqcyc = 0;
 		reqack0 = 0;
 		reqack1 = 0;
-		case(state)
-			ACKPROC: begin
-					//acknowledge on channel 0
-					if(channel == 0) begin
-						reqack0 = 1;
-					end
+		set_pending0 = 0;
+		set_pending1 = 0;
+		count_req0 = 0;
+		count_req1 = 0;
+		ready = (req_state == IDLE && !pending0 && !pending1);
 
-					//acknowledge channel 1
-					else if(channel == 1) begin
-						reqack1 = 1;
-					end
+		//a read can't go out while the other port has a read of the same line in flight
+		want0 = reqcyc0 == 1 && !(reqtag0[12] == `SYSBUS_READ && pending1 && pending_addr1 == req0[63:0] - (req0[63:0] % 64));
+		want1 = reqcyc1 == 1 && !(reqtag1[12] == `SYSBUS_READ && pending0 && pending_addr0 == req1[63:0] - (req1[63:0] % 64));
 
-					//transition to next state
-					if(req_tag[12] == `SYSBUS_WRITE) begin
-						_content = 0;
-						next_state = READVAL;
-					end
-					else begin
-						next_state = DRAMRD;
-					end
-				end
-			ACKVAL: begin
-					//acknowledge on channel 0
-					if(channel == 0) begin
-						reqack0 = 1;
-					end
+		if(req_state != IDLE) begin
+			grant = owner;
+		end
+		else if(want0 && want1) begin
+			//demand requests go before prefetches, whatever the policy
+			if(reqtag0[7:0] == `SYSBUS_PREFETCH && reqtag1[7:0] != `SYSBUS_PREFETCH) begin
+				grant = 1;
+			end
+			else if(reqtag1[7:0] == `SYSBUS_PREFETCH && reqtag0[7:0] != `SYSBUS_PREFETCH) begin
+				grant = 0;
+			end
+			else if(POLICY == DATA_FIRST) begin
+				grant = 1;
+			end
+			else if(POLICY == AGE) begin
+				grant = (age1 > age0);
+			end
+			else begin
+				grant = !last_grant;
+			end
+		end
+		else begin
+			grant = want1;
+		end
 
-					//acknowledge channel 1
-					else if(channel == 1) begin
-						reqack1 = 1;
-					end
+		if(req_state != IDLE || want0 || want1) begin
+			_owner = grant;
+			if(grant == 0) begin
+				bus_reqcyc = reqcyc0;
+				bus_req = req0;
+				bus_reqtag = reqtag0;
+				reqack0 = bus_reqack;
+			end
+			else begin
+				bus_reqcyc = reqcyc1;
+				bus_req = req1;
+				bus_reqtag = reqtag1;
+				reqack1 = bus_reqack;
+			end
+			bus_reqtag[PORT_TAG_BIT] = grant;
 
-					//transition to next state
-					next_ptr = ptr + 1;
-					if(ptr == 7) begin
-						next_state = DRAMWREQ;
-						next_ptr = 0;
-					end
-					else begin
-						next_state = READVAL;
-					end
-				end
-		endcase
-	end
+			case(req_state)
+				IDLE, ADDR: begin
+						if(bus_reqack == 1) begin
+							_last_grant = grant;
+							if(grant == 0) count_req0 = 1;
+							else count_req1 = 1;
 
-	//interact with the memory: DRAMWREQ, DRAMWRT, DRAMRD, RECEIVE
-	always_comb begin
-		//misc related variables
-		bus_reqcyc = 0;
-		bus_respack = 0;
-		_content = content;
-	   
-		case(state)
-			DRAMWREQ: begin
-					bus_reqcyc = 1;
-					bus_req = req_addr;
-                                        bus_reqtag = req_tag;
-					if(bus_reqack == 1) begin
-							next_ptr = 0;
-							next_state = DRAMWRT;
-					end
-					else begin
-						next_state = DRAMWREQ;
-					end
-				end
-			DRAMWRT: begin
-					bus_reqcyc = 1;
-					bus_req = content[64*ptr +: 64];
-					if(bus_reqack == 1) begin
-						next_ptr = ptr + 1;
-						if(ptr == 7) begin
-							next_state = ACCEPT;
+							if(bus_reqtag[12] == `SYSBUS_WRITE) begin
+								_wptr = 0;
+								_req_state = DATA;
+							end
+							else begin
+								if(grant == 0) set_pending0 = 1;
+								else set_pending1 = 1;
+								_req_state = IDLE;
+							end
 						end
 						else begin
-							next_state = DRAMWRT;
+							_req_state = ADDR;
 						end
 					end
-				end
-			DRAMRD: begin
-					//send request to memory
-					bus_reqcyc = 1;
-					bus_req = req_addr;
-					bus_reqtag = req_tag;
-
-					//determine if memory received request
-					if(bus_reqack == 1) begin
-						next_state = RECEIVE;
-					end
-					else begin
-						next_state = DRAMRD;
-					end
-				end
-			RECEIVE: begin
-					//receive reponse from memory if present
-					if(bus_respcyc == 1) begin
-						bus_respack = 1;
-						_content[64*ptr +: 64] = bus_resp;
-						next_ptr = ptr + 1;
-						if(ptr == 7) begin
-							next_state = RESPOND;
-							next_ptr = 0;
+				DATA: begin
+						if(bus_reqack == 1) begin
+							_wptr = wptr + 1;
+							if(wptr == LINE_BEATS-1) begin
+								_wptr = 0;
+								_req_state = IDLE;
+							end
 						end
-						else begin
-							next_state = RECEIVE;
-						end
-					end
-					else begin
-						bus_respack = 0;
-						next_state = RECEIVE;
-					end
-				end
-			RESPOND:begin
-					//respond to processor
-					if(bus_respcyc == 1) begin
-						bus_respack = 1;
-					end
-					//channel 0
-					if(channel == 0) begin
-						respcyc0 = 1;
-						resptag0 = req_tag;
-						resp0 = content[64*ptr +: 64];
-						ptr0 = ptr;
 					end
+			endcase
+		end
+	end
 
-					//channel 1
-					else if(channel == 1) begin
-						respcyc1 = 1;
-						resptag1 = req_tag;
-						resp1 = content[64*ptr +: 64];
-						ptr1 = ptr;
-					end
+	//route responses to the port named in the tag (invalidations are left for the processor)
+	always_comb begin
+		respcyc0 = 0;
+		respcyc1 = 0;
+		bus_respack = 0;
+		resp_channel = bus_resptag[PORT_TAG_BIT];
+		resp_valid = (bus_respcyc == 1 && bus_resptag != 12'h800);
 
-					//transition to next state
-					next_ptr = ptr;
-					next_state = RESPACK;
-				end
-			SETRESPZ: begin
-					respcyc0 = 0;
-					respcyc1 = 0;
-					next_ptr = ptr + 1;
-					if (ptr == 7) begin
-						next_state = ACCEPT;
-						next_ptr = 0;
-					end
-					else begin
-						next_state = RESPOND;
-					end
-				end
-		endcase
+		resp0 = bus_resp;
+		resptag0 = bus_resptag;
+		resptag0[PORT_TAG_BIT] = 0;
+		ptr0 = rptr0;
+		resp1 = bus_resp;
+		resptag1 = bus_resptag;
+		resptag1[PORT_TAG_BIT] = 0;
+		ptr1 = rptr1;
+
+		if(resp_valid) begin
+			if(resp_channel == 0) begin
+				respcyc0 = 1;
+				bus_respack = respack0;
+			end
+			else begin
+				respcyc1 = 1;
+				bus_respack = respack1;
+			end
+		end
 	end
 
-	//determine if processor received response: RESPACK
+	//count the beats each port received
 	always_comb begin
-		case(state)
-			RESPACK: begin
-					if(respack0 == 1 || respack1 == 1) begin
-						next_state = SETRESPZ;
-					end
-					else begin
-						next_state = RESPACK;
-					end
+		_rptr0 = rptr0;
+		_rptr1 = rptr1;
+		clear_pending0 = 0;
+		clear_pending1 = 0;
+		if(resp_valid && bus_respack == 1) begin
+			if(resp_channel == 0) begin
+				_rptr0 = rptr0 + 1;
+				if(rptr0 == LINE_BEATS-1) begin
+					_rptr0 = 0;
+					clear_pending0 = 1;
+				end
+			end
+			else begin
+				_rptr1 = rptr1 + 1;
+				if(rptr1 == LINE_BEATS-1) begin
+					_rptr1 = 0;
+					clear_pending1 = 1;
 				end
-		endcase
+			end
+		end
 	end
 
 	always_ff @ (posedge clk) begin
 		if(reset) begin
-			state <= INITIAL;
-			req_addr <= 0;
-			req_tag <= 0;
-			content <= 0;
-			ptr <= 0;
-		end
+			req_state <= IDLE;
+			owner <= 0;
+			last_grant <= 1;
+			wptr <= 0;
+			rptr0 <= 0;
+			rptr1 <= 0;
+			pending0 <= 0;
+			pending1 <= 0;
+			age0 <= 0;
+			age1 <= 0;
+			wait_cycles0 <= 0;
+			wait_cycles1 <= 0;
+			requests0 <= 0;
+			requests1 <= 0;
+		end else begin
 
 		//write values from wires to register
-		state <= next_state;
-		req_addr <= _req_addr;
-		req_tag <= _req_tag;
-		content <= _content;
-		ptr <= next_ptr;
-		channel <= _channel;
+		req_state <= _req_state;
+		owner <= _owner;
+		last_grant <= _last_grant;
+		wptr <= _wptr;
+		rptr0 <= _rptr0;
+		rptr1 <= _rptr1;
+
+		if(set_pending0) begin
+			pending0 <= 1;
+			pending_addr0 <= req0[63:0] - (req0[63:0] % 64);
+		end
+		else if(clear_pending0) begin
+			pending0 <= 0;
+		end
+		if(set_pending1) begin
+			pending1 <= 1;
+			pending_addr1 <= req1[63:0] - (req1[63:0] % 64);
+		end
+		else if(clear_pending1) begin
+			pending1 <= 0;
+		end
+
+		//queueing delay: cycles a port holds reqcyc without getting the ack
+		if(reqcyc0 == 1 && reqack0 == 0) begin
+			age0 <= age0 + 1;
+			wait_cycles0 <= wait_cycles0 + 1;
+		end
+		else begin
+			age0 <= 0;
+		end
+		if(reqcyc1 == 1 && reqack1 == 0) begin
+			age1 <= age1 + 1;
+			wait_cycles1 <= wait_cycles1 + 1;
+		end
+		else begin
+			age1 <= 0;
+		end
+		if(count_req0) requests0 <= requests0 + 1;
+		if(count_req1) requests1 <= requests1 + 1;
+
+		end
+	end
+
+	final begin
+		$display("Arbiter: port 0 (fetch) %0d requests, %0d cycles waiting", requests0, wait_cycles0);
+		$display("Arbiter: port 1 (memory) %0d requests, %0d cycles waiting", requests1, wait_cycles1);
 	end
 
 endmodule
@@ -1,7 +1,7 @@
 module cache
 	#(
 		//Memory bus constants
-		BUS_DATA_WIDTH = 64,
+		BUS_DATA_WIDTH = 64,		//memory side only (64, 128, 256 or 512); the processor side is always 64 bits
 		BUS_TAG_WIDTH = 13,
 
 		//State values
@@ -22,18 +22,28 @@ module cache
                 INVALIDATE = 14,
 
 		//Cache constants
-		NUM_CACHE_LINES = 32,
+		NUM_CACHE_LINES = 32,		//power of two; the index widths below follow from it
+		CACHE_TYPE = 1,			//0 = direct-mapped, 1 = 2-way set-associative
 		OFFSET = 6,			//offset = log2(64) (# addresses in cache line: 8 * 8 sets of 64 bits)
 		DATA_LENGTH = 512,
+		LINE_BEATS = DATA_LENGTH / BUS_DATA_WIDTH,	//memory beats per line
+		BEAT_WORDS = BUS_DATA_WIDTH / 64,		//doublewords per memory beat
 
 		//direct cache variables
-		DIR_CACHE_TAG = BUS_DATA_WIDTH - OFFSET - DIR_CACHE_INDEX, // 64-6-5 = 53
-		DIR_CACHE_INDEX = 5,	//index = log2(32) (# sets in the cache)
+		DIR_CACHE_TAG = 64 - OFFSET - DIR_CACHE_INDEX, // 64-6-5 = 53
+		DIR_CACHE_INDEX = $clog2(NUM_CACHE_LINES),	//index = log2(32) (# sets in the cache)
 
 		//set cache variables
-		SET_CACHE_TAG = BUS_DATA_WIDTH - OFFSET - SET_CACHE_INDEX, // 54
-		SET_CACHE_INDEX = 4,	//index = log2(16) (# sets in the cache) 
-		NUM_CACHE_SETS = 16
+		SET_CACHE_TAG = 64 - OFFSET - SET_CACHE_INDEX, // 54
+		SET_CACHE_INDEX = $clog2(NUM_CACHE_SETS),	//index = log2(16) (# sets in the cache) 
+		NUM_CACHE_SETS = NUM_CACHE_LINES / 2,
+
+		//prefetch variables
+		PREFETCH = 0,		//0 = off, 1 = next-N-line (I-cache), 2 = PC-indexed stride (D-cache)
+		PREFETCH_DEGREE = 2,	//# lines prefetched per trigger
+		PREFETCH_DISTANCE = 1,	//# lines (or strides) ahead of the demand access for the first prefetch
+		STRIDE_ENTRIES = 16,	//# entries in the stride table
+		STRIDE_INDEX = 4	//index = log2(16), taken from the pc of the access
 	)
 	(
 		input  clk,
@@ -43,16 +53,17 @@ module cache
 		// interface to connect to the bus on the procesor side
 		input p_bus_reqcyc,				//set to 1 when a read is requested
 		output  p_bus_reqack,				//acknowledgement of request from processor
-		input [BUS_DATA_WIDTH-1:0] p_bus_req,		//the address I wanna read
+		input [63:0] p_bus_req,		//the address I wanna read
 		input [BUS_TAG_WIDTH-1:0] p_bus_reqtag,		//tag associated with request (useful in superscalar)
+		input [63:0] req_pc,				//pc of the instruction making the request (for the stride prefetcher)
 
 		output  p_bus_respcyc,				//set to 1 when ready to respond
 		input p_bus_respack, 				//acknowledgement by processor when receiving the data
-		output  [BUS_DATA_WIDTH-1:0] p_bus_resp,	//content of requested address
+		output  [63:0] p_bus_resp,	//content of requested address
 		output  [BUS_TAG_WIDTH-1:0] p_bus_resptag,	//tag associated with response (useful in superscalar)
 		output [8:0] out_ptr,
                 output invalidated,
-		input [BUS_DATA_WIDTH-1:0] inv_req,
+		input [63:0] inv_req,
 
 
 		// interface to connect to the bus on the dram(memory) side
@@ -65,7 +76,23 @@ module cache
 		output m_bus_respack,				//acknowlegement of response sent to memory
 		input  [BUS_DATA_WIDTH-1:0] m_bus_resp,		//the contents of the requested address
 		input  [BUS_TAG_WIDTH-1:0] m_bus_resptag,	//tag associated with request (useful in superscalar)
-		output [8:0] mem_ptr
+		output [8:0] mem_ptr,
+
+		// LR/SC reservation (RV64A), kept here so invalidations and evictions drop it
+		input resv_set,					//LR: reserve the line of resv_addr
+		input resv_clear,				//SC: drop the reservation
+		input [63:0] resv_addr,
+		output resv_valid,				//1 while resv_line is reserved
+		output [63:0] resv_line,
+
+		// prefetcher control
+		input pf_hold,					//1 while the core waits for an ecall: no new prefetches, so the
+								//invalidations from the call find the cache in ACCEPT
+		output pf_busy,					//1 while a prefetch is being looked up or filled
+
+		output miss,					//1 for one cycle on each demand miss (for the profiler)
+		output access,					//1 for one cycle on each lookup of the tags and data (for the energy model)
+		output fill					//1 for one cycle on each line write (fill or store)
 	);
 
 	//variables used in all states
@@ -77,9 +104,11 @@ module cache
 	logic [3:0] next_state;
 	logic [DATA_LENGTH-1:0] content;
 	logic [DATA_LENGTH-1:0] _content;
+	logic [63:0] req_pc_reg;
+	logic [63:0] _req_pc_reg;
 
 	//cache management-related variables
-	logic cache_type = 1; //set to 0 for direct-mapped cache, 1 for set-associative cache.
+	logic cache_type = CACHE_TYPE; //0 for direct-mapped cache, 1 for set-associative cache.
 	logic [OFFSET-1:0] offset; // Don't need offset because all requests are 64 byte aligned.
 	logic [NUM_CACHE_LINES-1:0] valid_bits;
 	logic [NUM_CACHE_LINES-1:0] _valid_bits;
@@ -105,12 +134,78 @@ module cache
 	logic [8:0] zcounter;
 	logic [8:0] _zcounter;
 
+	//early restart: the critical doubleword goes to the processor before the whole line is in
+	logic early;		//1 if the processor only wants the doubleword at req_addr
+	logic [2:0] mem_beat;	//beat of the line the memory is sending (the beat with the critical word comes first)
+	logic [7:0] fill_mask;	//doublewords of the line received so far
+	logic [7:0] _fill_mask;
+	logic crit_sent;	//the processor has the critical word
+	logic _crit_sent;
+	logic second;		//a read of the line being filled was accepted and not answered yet
+	logic _second;
+	logic [2:0] second_word;
+	logic [2:0] _second_word;
+	logic merge_req;	//read of the line being filled, taken without waiting for the fill
+	logic fill_respcyc;	//respond from the line being filled
+	logic [2:0] fill_word;
+
         //variables to use when invalidating
 	logic [DIR_CACHE_TAG-1:0] inv_dir_tag;
 	logic [DIR_CACHE_INDEX-1:0] inv_dir_index;
 	logic [SET_CACHE_TAG-1:0] inv_set_tag;
 	logic [SET_CACHE_INDEX-1:0] inv_set_index;
 
+	//variables for the prefetcher
+	logic prefetching;	//1 if the current request is a prefetch (not from the processor)
+	logic _prefetching;
+	logic [63:0] pf_addr;	//next line to prefetch
+	logic [63:0] _pf_addr;
+	logic signed [63:0] pf_stride;
+	logic signed [63:0] _pf_stride;
+	logic [7:0] pf_count;	//# prefetches left to issue
+	logic [7:0] _pf_count;
+	logic [63:0] pf_page;	//page of the access that started the prefetches, they don't leave it
+	logic [63:0] _pf_page;
+	logic pf_inpage;
+	logic pf_issue;
+	logic [NUM_CACHE_LINES-1:0] pf_bits;	//1 if the line was prefetched and not used yet
+	logic [NUM_CACHE_LINES-1:0] _pf_bits;
+	logic [63:0] st_pc[STRIDE_ENTRIES-1:0];
+	logic [63:0] _st_pc[STRIDE_ENTRIES-1:0];
+	logic [63:0] st_last_addr[STRIDE_ENTRIES-1:0];
+	logic [63:0] _st_last_addr[STRIDE_ENTRIES-1:0];
+	logic signed [63:0] st_stride[STRIDE_ENTRIES-1:0];
+	logic signed [63:0] _st_stride[STRIDE_ENTRIES-1:0];
+	logic [1:0] st_conf[STRIDE_ENTRIES-1:0];
+	logic [1:0] _st_conf[STRIDE_ENTRIES-1:0];
+	logic [STRIDE_INDEX-1:0] st_index;
+	logic signed [63:0] st_delta;
+	logic [63:0] req_line;	//req_addr aligned to the line
+	logic [DIR_CACHE_INDEX-1:0] hit_line;	//cache line that hit in LOOKUP
+	logic demand_hit;
+	logic demand_miss;
+	logic late_seen;	//the processor already asked for the line being prefetched
+	logic _late_seen;
+
+	//LR/SC reservation: one line at a time
+	logic _resv_valid;
+	logic [63:0] _resv_line;
+	logic resv_evict;	//UPDATE is putting another line where the reserved one is
+
+	//prefetch statistics, printed at the end of simulation
+	logic [63:0] pf_issued;
+	logic [63:0] pf_useful;
+	logic [63:0] pf_late;
+	logic [63:0] demand_misses;
+	logic [63:0] demand_hits;
+
+	assign early = ((req_tag[7:0] & `SYSBUS_EARLY) != 0);
+	assign mem_beat = (req_addr[5:3] / BEAT_WORDS + mem_ptr[2:0]) % LINE_BEATS;
+	assign miss = demand_miss;
+	assign pf_busy = (prefetching == 1 && state != ACCEPT);
+	assign access = (state == LOOKUP);
+	assign fill = (state == UPDATE);
+
 	//NOTE: multiple always comb blocks used to keep verilator happy
 	//	processor resp, ack, and cyc variables cannot be set or used within the same block
    
@@ -119,6 +214,11 @@ module cache
 
                 invalidated = 0;
 
+		//a read of the line being filled is taken right away and answered once its doubleword is in
+		merge_req = (state == RECEIVE && (crit_sent == 1 || prefetching == 1) && second == 0
+			&& p_bus_reqcyc == 1 && p_bus_reqtag[12] == `SYSBUS_READ && (p_bus_reqtag[7:0] & `SYSBUS_EARLY) != 0
+			&& (p_bus_req - (p_bus_req % 64)) == (req_addr - (req_addr % 64)));
+
 		case(state)
 			INITIAL: begin
 					//Initialize the system
@@ -128,6 +228,8 @@ module cache
 					//wait for requests from the processor
 					_req_addr = p_bus_req;
 					_req_tag = p_bus_reqtag;
+					_req_pc_reg = req_pc;
+					_prefetching = 0;
 					next_ptr = 0;
 					set_cache_index = 0;
                                         
@@ -137,6 +239,13 @@ module cache
 					else if(p_bus_reqcyc == 1) begin
 						next_state = ACKPROC;
 					end
+					else if(pf_issue == 1) begin
+						//nothing from the processor, so use the slot for a prefetch
+						_req_addr = pf_addr - (pf_addr % 64);
+						_req_tag = {`SYSBUS_READ,`SYSBUS_MEMORY,`SYSBUS_PREFETCH};
+						_prefetching = 1;
+						next_state = LOOKUP;
+					end
 					else begin
 						next_state = ACCEPT;
 					end
@@ -190,7 +299,7 @@ module cache
 
 	//acknowledge receiving request and values from processor: ACKPROC, ACKVAL
 	always_comb begin
-		p_bus_reqack = 0;
+		p_bus_reqack = merge_req;
 		case(state)
 			ACKPROC: begin
 					p_bus_reqack = 1;
@@ -225,6 +334,7 @@ module cache
 		m_bus_respack = 0;
 		_content = content;
 		_valid_bits = valid_bits;
+		_fill_mask = fill_mask;
 	   
 		//extract tag, index, offset from address
 		dir_tag = req_addr[63:63-DIR_CACHE_TAG+1];  // 63:11
@@ -232,6 +342,10 @@ module cache
 		set_tag = req_addr[63:63-SET_CACHE_TAG+1]; // 63:10
 		set_index = req_addr[63-SET_CACHE_TAG:OFFSET]; // 9:6
 		offset = req_addr[OFFSET-1:0]; // 5:0 
+		_pf_bits = pf_bits;
+		demand_hit = 0;
+		demand_miss = 0;
+		hit_line = 0;
 	   
 		case(state)
 			LOOKUP: begin
@@ -250,9 +364,15 @@ module cache
 							else if(valid_bits[2*set_index + 1] == 1 && set_cache_tags[2*set_index + 1] == set_tag) begin
 								set_cache_index = 2*set_index + 1;
 							end 
+							else if(valid_bits[2*set_index] == 0) begin
+								set_cache_index = 2*set_index;
+							end
+							else if(valid_bits[2*set_index + 1] == 0) begin
+								set_cache_index = 2*set_index + 1;
+							end
 							else begin
-								// Just choose randomly.
-								set_cache_index = 2*set_index + req_addr[0]; 
+								// Just choose randomly (lowest tag bit, since req_addr is 64 byte aligned).
+								set_cache_index = 2*set_index + req_addr[OFFSET+SET_CACHE_INDEX]; 
 							end
 						end
 
@@ -265,11 +385,14 @@ module cache
 							//cache hit on read
 							next_state = RESPOND;
 							_content = cache_data[dir_index];
+							hit_line = dir_index;
+							demand_hit = !prefetching;
 						end
 						else begin
 							//cache miss on read
 							next_state = DRAMRD;
 							_content = 0;
+							demand_miss = !prefetching;
 						end
 					end
 					else begin //set cache
@@ -279,27 +402,54 @@ module cache
 							next_state = RESPOND;
 							_content = cache_data[2*set_index];
 							set_cache_index = 2*set_index;
+							hit_line = set_cache_index;
+							demand_hit = !prefetching;
 						end
 						else if(valid_bits[2*set_index + 1] == 1 && set_cache_tags[2*set_index + 1] == set_tag) begin
 							//cache hit on read
 							next_state = RESPOND;
 							_content = cache_data[2*set_index + 1];
 							set_cache_index = 2*set_index + 1;
+							hit_line = set_cache_index;
+							demand_hit = !prefetching;
 						end
 						else begin
 							//cache miss on read
 							next_state = DRAMRD;
 							_content = 0;
-							// Just choose randomly.
-							set_cache_index = 2*set_index + req_addr[0]; 
+							demand_miss = !prefetching;
+							if(valid_bits[2*set_index] == 0) begin
+								set_cache_index = 2*set_index;
+							end
+							else if(valid_bits[2*set_index + 1] == 0) begin
+								set_cache_index = 2*set_index + 1;
+							end
+							else begin
+								// Just choose randomly (lowest tag bit, since req_addr is 64 byte aligned).
+								set_cache_index = 2*set_index + req_addr[OFFSET+SET_CACHE_INDEX]; 
+							end
 						end
 					end
+
+					if(prefetching == 1 && next_state == RESPOND) begin
+						//already cached, so drop the prefetch
+						next_state = ACCEPT;
+					end
+					if(next_state == RESPOND) begin
+						next_ptr = early ? req_addr[5:3] : 0;
+					end
+					if(demand_hit == 1 && pf_bits[hit_line] == 1) begin
+						//first use of a prefetched line
+						_pf_bits[hit_line] = 0;
+					end
 				end
 			DRAMRD: begin
 					//send request to memory
+					//req_addr keeps the doubleword offset, so memory sends the critical word first
 					m_bus_reqcyc = 1;
 					m_bus_req = req_addr;
 					m_bus_reqtag = req_tag;
+					_fill_mask = 0;
 
 					//determine if memory received request
 					if(m_bus_reqack == 1) begin
@@ -318,9 +468,12 @@ module cache
 					end
 					else if(m_bus_respcyc == 1) begin
 						m_bus_respack = 1;
-						_content[64*mem_ptr +: 64] = m_bus_resp;
+						_content[BUS_DATA_WIDTH*mem_beat +: BUS_DATA_WIDTH] = m_bus_resp;
+						for(int i = 0; i < BEAT_WORDS; i++) begin
+							_fill_mask[BEAT_WORDS*mem_beat + i] = 1;
+						end
 						next_state = RECEIVE;
-						if(mem_ptr == 7) begin
+						if(mem_ptr == LINE_BEATS-1) begin
 							next_state = UPDATE;
 							next_ptr = 0;
 						end
@@ -340,17 +493,32 @@ module cache
 						_valid_bits[dir_index] = 1; // saying its valid to retrieve.
 						_dir_cache_tags[dir_index] = dir_tag; // marking new tag.
 						_cache_data[dir_index] = content; // write the content retrieved back to cache block.
+						_pf_bits[dir_index] = prefetching;
 					end
 					else begin //set cache
 						_valid_bits[set_cache_index] = 1; 
 						_set_cache_tags[set_cache_index] = set_tag; 
 						_cache_data[set_cache_index] = content; 
+						_pf_bits[set_cache_index] = prefetching;
+					end
+					if(second == 1) begin
+						//the processor is already using the line
+						_pf_bits[(cache_type == 0) ? dir_index : set_cache_index] = 0;
 					end
 
 					if(req_tag[12] == `SYSBUS_WRITE) begin
 						next_state = DRAMWREQ;
 					end
+					else if(second == 1) begin
+						//the merged read came in after its doubleword was sent on to the processor
+						next_ptr = second_word;
+						next_state = RESPOND;
+					end
+					else if(prefetching == 1 || crit_sent == 1) begin
+						next_state = ACCEPT;
+					end
 					else begin
+						next_ptr = early ? req_addr[5:3] : 0;
 						next_state = RESPOND;
 					end
 				end
@@ -368,10 +536,10 @@ module cache
 				end
 			DRAMWRT: begin
 					m_bus_reqcyc = 1;
-					m_bus_req = content[64*ptr +: 64];
+					m_bus_req = content[BUS_DATA_WIDTH*ptr +: BUS_DATA_WIDTH];
 					if(m_bus_reqack == 1) begin
 						next_ptr = ptr + 1;
-						if(ptr == 7) begin
+						if(ptr == LINE_BEATS-1) begin
 							next_state = ACCEPT;
 						end
 						else begin
@@ -383,8 +551,27 @@ module cache
 	end
 
 	//respond to processor: RESPOND
+	//while a line is being filled, the critical word (and a merged read) is sent from the fill as soon as it is in
 	always_comb begin
 		out_ptr = ptr;
+		p_bus_respcyc = 0;
+		fill_respcyc = 0;
+		fill_word = req_addr[5:3];
+		if(state == RECEIVE) begin
+			if(early == 1 && prefetching == 0 && crit_sent == 0 && fill_mask[req_addr[5:3]] == 1) begin
+				fill_respcyc = 1;
+			end
+			else if(second == 1 && fill_mask[second_word] == 1) begin
+				fill_respcyc = 1;
+				fill_word = second_word;
+			end
+			if(fill_respcyc == 1) begin
+				p_bus_respcyc = 1;
+				p_bus_resp = content[64*fill_word +: 64];
+				p_bus_resptag = req_tag;
+				out_ptr = fill_word;
+			end
+		end
 		case(state)
 			RESPOND:begin
 					p_bus_respcyc = 1;
@@ -393,11 +580,18 @@ module cache
 					next_ptr = ptr;
 					next_state = RESPACK;
 				end
+			RESPACK: begin
+					//keep the beat up until the processor takes it
+					p_bus_respcyc = 1;
+					p_bus_resp = content[64*ptr +: 64];
+					p_bus_resptag = req_tag;
+				end
 			SETRESPZ: begin
 					//third state solely to keep verilator happy
 					next_ptr = ptr + 1;
 					p_bus_respcyc = 0;
-					if(ptr == 7) begin
+					if(ptr == 7 || early == 1 || second == 1) begin
+						//early requests only get one doubleword
 						next_state = ACCEPT;
 					end
 					else begin
@@ -409,6 +603,25 @@ module cache
 
 	//determine if processor received response: RESPACK
 	always_comb begin
+		_crit_sent = crit_sent;
+		_second = second;
+		_second_word = second_word;
+		if(merge_req == 1) begin
+			_second = 1;
+			_second_word = p_bus_req[5:3];
+		end
+		if(fill_respcyc == 1 && p_bus_respack == 1) begin
+			if(second == 1) begin
+				_second = 0;
+			end
+			else begin
+				_crit_sent = 1;
+			end
+		end
+		if(state == ACCEPT) begin
+			_crit_sent = 0;
+			_second = 0;
+		end
 		case(state)
 			RESPACK: begin
 					if(p_bus_respack == 1) begin
@@ -421,6 +634,109 @@ module cache
 		endcase
 	end
 
+	//train the prefetcher and pick the next line to prefetch
+	always_comb begin
+		_pf_addr = pf_addr;
+		_pf_stride = pf_stride;
+		_pf_count = pf_count;
+		_pf_page = pf_page;
+		_late_seen = late_seen;
+		for(int i = 0; i < STRIDE_ENTRIES; i++) begin
+			_st_pc[i] = st_pc[i];
+			_st_last_addr[i] = st_last_addr[i];
+			_st_stride[i] = st_stride[i];
+			_st_conf[i] = st_conf[i];
+		end
+		st_index = req_pc_reg[2 +: STRIDE_INDEX];
+		req_line = req_addr - (req_addr % 64);
+		st_delta = req_line - st_last_addr[st_index];
+
+		//prefetches only take the slots the processor (and invalidations) leave free.
+		//They stay in the page of the access that started them, so they don't run past the end of memory.
+		pf_inpage = (pf_addr[63:12] == pf_page[63:12]);
+		pf_issue = (PREFETCH != 0 && pf_count != 0 && pf_inpage && pf_hold == 0 && inv_req == 0 && p_bus_reqcyc == 0);
+		if(pf_count != 0 && !pf_inpage) begin
+			_pf_count = 0;
+		end
+		if(state == ACCEPT && pf_issue == 1) begin
+			_pf_addr = pf_addr + pf_stride;
+			_pf_count = pf_count - 1;
+			_late_seen = 0;
+		end
+
+		//the processor asked for the line while it was still being prefetched
+		if(prefetching == 1 && p_bus_reqcyc == 1 && (p_bus_req - (p_bus_req % 64)) == req_addr) begin
+			_late_seen = 1;
+		end
+
+		if(state == LOOKUP && prefetching == 0) begin
+			if(PREFETCH == 1) begin
+				//next-N-line: on a miss, or on the first use of a prefetched line
+				if(demand_miss == 1 || (demand_hit == 1 && pf_bits[hit_line] == 1)) begin
+					_pf_addr = req_line + 64*PREFETCH_DISTANCE;
+					_pf_stride = 64;
+					_pf_count = PREFETCH_DEGREE;
+					_pf_page = req_line;
+				end
+			end
+			else if(PREFETCH == 2 && st_delta != 0) begin
+				//stride: accesses to the same line don't tell us anything, so skip them
+				if(st_pc[st_index] != req_pc_reg) begin
+					//another instruction took the entry
+					_st_pc[st_index] = req_pc_reg;
+					_st_stride[st_index] = 0;
+					_st_conf[st_index] = 0;
+				end
+				else if(st_delta == st_stride[st_index]) begin
+					if(st_conf[st_index] != 3) begin
+						_st_conf[st_index] = st_conf[st_index] + 1;
+					end
+				end
+				else begin
+					_st_stride[st_index] = st_delta;
+					_st_conf[st_index] = 0;
+				end
+				_st_last_addr[st_index] = req_line;
+
+				//same stride seen twice in a row
+				if(_st_conf[st_index] != 0) begin
+					_pf_addr = req_line + st_delta*PREFETCH_DISTANCE;
+					_pf_stride = st_delta;
+					_pf_count = PREFETCH_DEGREE;
+					_pf_page = req_line;
+				end
+			end
+		end
+	end
+
+	//keep the LR/SC reservation
+	always_comb begin
+		_resv_valid = resv_valid;
+		_resv_line = resv_line;
+		if(cache_type == 0) begin
+			resv_evict = (valid_bits[dir_index] == 1 && {dir_cache_tags[dir_index], dir_index} == resv_line[63:OFFSET]);
+		end
+		else begin
+			resv_evict = (valid_bits[set_cache_index] == 1 && {set_cache_tags[set_cache_index], set_index} == resv_line[63:OFFSET]);
+		end
+		resv_evict = resv_evict && req_addr[63:OFFSET] != resv_line[63:OFFSET];
+
+		if(resv_clear == 1) begin
+			_resv_valid = 0;
+		end
+		else if(state == INVALIDATE && inv_req[63:OFFSET] == resv_line[63:OFFSET]) begin
+			//the host wrote the line (System::invalidate)
+			_resv_valid = 0;
+		end
+		else if(state == UPDATE && resv_evict == 1) begin
+			_resv_valid = 0;
+		end
+		if(resv_set == 1) begin
+			_resv_valid = 1;
+			_resv_line = resv_addr - (resv_addr % 64);
+		end
+	end
+
 	always_ff @ (posedge clk) begin
 		if(reset) begin
 			state <= INITIAL;
@@ -435,6 +751,22 @@ module cache
 				dir_cache_tags[i] <= 0;
 				set_cache_tags[i] <= 0;
 			end
+			prefetching <= 0;
+			pf_count <= 0;
+			pf_bits <= 0;
+			pf_issued <= 0;
+			pf_useful <= 0;
+			pf_late <= 0;
+			demand_misses <= 0;
+			demand_hits <= 0;
+			fill_mask <= 0;
+			resv_valid <= 0;
+			crit_sent <= 0;
+			second <= 0;
+			for(int i = 0; i < STRIDE_ENTRIES; i++) begin
+				st_pc[i] <= 0;
+				st_conf[i] <= 0;
+			end
 		end
 
 		//write values from wires to register
@@ -445,11 +777,52 @@ module cache
 		ptr <= next_ptr;
 		zcounter <= _zcounter;
 		valid_bits <= _valid_bits;
+		fill_mask <= _fill_mask;
+		resv_valid <= _resv_valid;
+		resv_line <= _resv_line;
+		crit_sent <= _crit_sent;
+		second <= _second;
+		second_word <= _second_word;
 		for(int i = 0; i < NUM_CACHE_LINES; i++) begin
 			cache_data[i] <= _cache_data[i];
 			dir_cache_tags[i] <= _dir_cache_tags[i];
 			set_cache_tags[i] <= _set_cache_tags[i];
 		end
+
+		//prefetcher
+		req_pc_reg <= _req_pc_reg;
+		prefetching <= _prefetching;
+		pf_addr <= _pf_addr;
+		pf_stride <= _pf_stride;
+		pf_count <= _pf_count;
+		pf_page <= _pf_page;
+		pf_bits <= _pf_bits;
+		late_seen <= _late_seen;
+		for(int i = 0; i < STRIDE_ENTRIES; i++) begin
+			st_pc[i] <= _st_pc[i];
+			st_last_addr[i] <= _st_last_addr[i];
+			st_stride[i] <= _st_stride[i];
+			st_conf[i] <= _st_conf[i];
+		end
+		if(state == DRAMRD && prefetching == 1 && m_bus_reqack == 1) pf_issued <= pf_issued + 1;
+		//a read that merges into a prefetch fill used the prefetch; it is late too (late_seen goes up with it)
+		if((demand_hit == 1 && pf_bits[hit_line] == 1) || (merge_req == 1 && prefetching == 1)) pf_useful <= pf_useful + 1;
+		if(demand_miss == 1) demand_misses <= demand_misses + 1;
+		if(demand_hit == 1) demand_hits <= demand_hits + 1;
+		if(_late_seen == 1 && late_seen == 0) pf_late <= pf_late + 1;
+	end
+
+	//accuracy = useful / issued, coverage = useful / (useful + misses), timeliness = late / useful
+	final begin
+		$display("%m: %0d demand accesses, %0d misses", demand_hits + demand_misses, demand_misses);
+		if(PREFETCH != 0) begin
+			$display("%m prefetcher: %0d issued, %0d useful, %0d late, %0d demand misses",
+				pf_issued, pf_useful, pf_late, demand_misses);
+			if(pf_issued != 0 && pf_useful != 0) begin
+				$display("%m prefetcher: accuracy %0d%%, coverage %0d%%, late %0d%%",
+					pf_useful*100/pf_issued, pf_useful*100/(pf_useful + demand_misses), pf_late*100/pf_useful);
+			end
+		end
 	end
 
 endmodule
@@ -198,6 +198,19 @@ module decoder
 					instr_type = `STYPE;
 					mem_access = `MEM_WRITE;
 				end
+
+			//atomics (RV64A): the address is rs1, MEM does the rest
+			7'b0101111: begin
+					if(func3 == 3'b010 || func3 == 3'b011) begin
+						if(debug) $display("amo %b (func3 %b) $%d, $%d, ($%d)", instruction[31:27], func3, rd, rs2, rs1);
+						alu_op = `ADD;
+						immediate = 0;
+						instr_type = `STYPE;
+						mem_size = func3[0] ? `MEM_DOUBLE : `MEM_WORD;
+						mem_access = `MEM_ATOMIC;
+						reg_write = 1;
+					end
+				end
 			
 			//r_instr
 			7'b0111011: begin //64R
@@ -1,5 +1,10 @@
 #include <iostream>
 #include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
 #include <sys/mman.h>
 #include <sys/uio.h>
 #include <syscall.h>
@@ -35,8 +40,26 @@ extern "C" {
 #define ECALL_DEBUG 0
 #define ECALL_MEMGUARD (10*1024)
 
-    void do_ecall(long long a7, long long a0, long long a1, long long a2, long long a3, long long a4, long long a5, long long a6, long long* a0ret) {
-        vector<pair<long long, char[ECALL_MEMGUARD+63]> > memargs;
+    typedef vector<pair<long long, char[ECALL_MEMGUARD+63]> > ecall_memargs;
+
+    // one system call, with the pointer arguments moved to where the guest memory is mapped
+    struct ecall_call {
+        long long a7, a0, a1, a2, a3, a4, a5, a6;
+        ecall_memargs memargs;
+        ecall_memargs bounce; // copies of memargs the call works on when it runs on the I/O thread
+    };
+
+    // handles the calls the simulator takes care of itself (returns true, *a0ret is set),
+    // or gets the arguments ready for running the call on the host (returns false)
+    static bool ecall_prepare(ecall_call& c, long long* a0ret) {
+        long long& a7 = c.a7;
+        long long& a0 = c.a0;
+        long long& a1 = c.a1;
+        long long& a2 = c.a2;
+        long long& a3 = c.a3;
+        long long& a4 = c.a4;
+        long long& a5 = c.a5;
+        ecall_memargs& memargs = c.memargs;
 
         switch(a7) {
 
@@ -47,7 +70,7 @@ extern "C" {
                 System::sys->ecall_brk = a0;
             }
             *a0ret = System::sys->ecall_brk;
-            return;
+            return true;
 
         case __NR_mmap:
             assert(a0 == 0 && (a3 & MAP_ANONYMOUS)); // only support ANONYMOUS mmap with NULL argument
@@ -56,34 +79,40 @@ extern "C" {
             for(long long addr = System::sys->ecall_brk; addr < System::sys->ecall_brk+a1; ++addr) System::sys->virt_to_phy(addr); // prefault
             System::sys->ecall_brk += a1;
             System::sys->ecall_brk = (System::sys->ecall_brk + PAGE_SIZE-1) & ~(PAGE_SIZE-1); // align to 4K boundary
-            return;
+            return true;
 
         case __NR_munmap:
             *a0ret = 0; // don't bother unmapping
-            return;
+            return true;
+
+        case ECALL_ROI:
+            System::sys->roi(a0 != 0);
+            *a0ret = 0;
+            return true;
 
         case __NR_exit_group:
         case __NR_exit:
         case __NR_tgkill:
             Verilated::gotFinish(true);
-            return;
+            return true;
 
+        // only for binaries built without the A extension; the core runs LR/SC and AMOs itself
         case 1244/*__NR_arch_specific_syscall*/:
             switch(a0) {
                 case 1/*RISCV_ATOMIC_CMPXCHG*/:
                     a1 = System::sys->virt_to_phy(a1);
                     if (*(uint32_t*)&System::sys->ram[a1] == a2) *(uint32_t*)&System::sys->ram[a1] = a3;
                     *a0ret = a2;
-                    return;
+                    return true;
                 case 2/*RISCV_ATOMIC_CMPXCHG64*/:
                     a1 = System::sys->virt_to_phy(a1);
                     if (*(uint64_t*)&System::sys->ram[a1] == a2) *(uint64_t*)&System::sys->ram[a1] = a3;
                     *a0ret = a2;
-                    return;
+                    return true;
                 default:
                     cerr << "Unsupported arch-specific syscall " << a0 << endl;
                     Verilated::gotFinish(true);
-                    return;
+                    return true;
             }
 
         case __NR_rt_sigpending: // a0
@@ -98,7 +127,7 @@ extern "C" {
         case __NR_rt_tgsigqueueinfo:
             if (ECALL_DEBUG) cerr << "NO-OP syscall " << std::dec << a7 << endl;
             *a0ret = 0;
-            return;
+            return true;
 
 #define ECALL_OFFSET(v)                                                  \
     do {                                                                 \
@@ -365,7 +394,7 @@ extern "C" {
         case __NR_pwritev:
             cerr << "Unsupported syscall " << std::dec << a7 << endl;
             Verilated::gotFinish(true);
-            return;
+            return true;
 
         default:
             if (ECALL_DEBUG) cerr << "Default syscall " << std::dec << a7 << endl;
@@ -388,18 +417,35 @@ extern "C" {
             for(int i = 0; i < a2; ++i)
                 iov[i].iov_base = (char*)iov[i].iov_base + (long long)System::sys->ram_virt;
 
+        return false;
+    }
+
+    // runs the call on the host. Only touches guest memory through the pointers set up by ecall_prepare.
+    static long long ecall_host(const ecall_call& c, int& new_errno) {
         int old_errno = errno;
-        *a0ret = syscall(a7, a0, a1, a2, a3, a4, a5, a6);
-        if (old_errno != errno) {
-            if (ECALL_DEBUG) cerr << "Changing errno to " << std::dec << errno << endl;
-            System::sys->set_errno(errno);
+        long long ret = syscall(c.a7, c.a0, c.a1, c.a2, c.a3, c.a4, c.a5, c.a6);
+        new_errno = (old_errno != errno) ? errno : 0;
+        return ret;
+    }
+
+    // back on the simulator thread: set errno and invalidate the lines the call changed
+    static void ecall_finish(const ecall_call& c, const int new_errno) {
+        // what the call wrote to the copies goes to guest memory only now
+        for(size_t m = 0; m < c.bounce.size(); ++m)
+            for(int i = 0; i < ECALL_MEMGUARD; ++i)
+                if (c.bounce[m].second[i] != c.memargs[m].second[i])
+                    System::sys->ram[System::sys->virt_to_phy((c.memargs[m].first & ~63) + i)] = c.bounce[m].second[i];
+
+        if (new_errno) {
+            if (ECALL_DEBUG) cerr << "Changing errno to " << std::dec << new_errno << endl;
+            System::sys->set_errno(new_errno);
         }
 
-        if (a7 == __NR_writev)
-            for(int i = 0; i < a2; ++i)
+        iovec* iov = (iovec*)c.a1;
+        if (c.a7 == __NR_writev)
+            for(int i = 0; i < c.a2; ++i)
                 iov[i].iov_base = (char*)iov[i].iov_base - (long long)System::sys->ram_virt;
 
-        if (ECALL_DEBUG) cerr << " => " << std::dec << *a0ret << endl;
 //	cerr << "malloc 95c28: " << *((uint64_t*)&System::sys->ram[0x95c28]) << std::hex << endl;
 
 //	cerr << "malloc 28: " << *((uint64_t*)&System::sys->ram[0x28]) << std::hex << endl;
@@ -407,7 +453,7 @@ extern "C" {
         //cerr << "After Value: " << *((uint64_t*)&System::sys->ram[0x3fbffd9a]) << std::dec << std::endl;
 
         set<long long> invalidations;
-        for(auto& m : memargs)
+        for(auto& m : c.memargs)
             for(int i = 0; i < ECALL_MEMGUARD; ++i) {
                 long long physptr = System::sys->virt_to_phy((m.first & ~63) + i);
                 if (m.second[i] != System::sys->ram[physptr]) {
@@ -419,4 +465,178 @@ extern "C" {
             System::sys->invalidate(i);
     }
 
+    void do_ecall(long long a7, long long a0, long long a1, long long a2, long long a3, long long a4, long long a5, long long a6, long long* a0ret) {
+        ecall_call c = { a7, a0, a1, a2, a3, a4, a5, a6 };
+        if (ecall_prepare(c, a0ret)) return;
+        int new_errno;
+        *a0ret = ecall_host(c, new_errno);
+        if (ECALL_DEBUG) cerr << " => " << std::dec << *a0ret << endl;
+        ecall_finish(c, new_errno);
+    }
+
+    // With ASYNC_ECALL=1, reads, writes and sleeps run on a separate I/O thread, so a blocking
+    // read or nanosleep doesn't hold up the simulation. The core waits in ecall_stallstate until
+    // do_ecall_done says the call is finished. Only one call is in flight at a time.
+    //
+    // Simulated time goes on while the call runs on the host. Once it has returned, the core waits
+    // until the call has cost ECALL_CYCLES=<n> cycles (0 by default), or with ECALL_CYCLES=host,
+    // the time the call took on the host at PS_PER_CLOCK. A call that returns later than that is
+    // charged the cycles that went by until it did.
+    static struct {
+        bool async;
+        bool checked_env;
+        long long cost;         // cycles per call, -1 for the host time
+        ecall_call call;
+        long long ret;
+        int new_errno;
+        bool on_host;           // call was handed to the I/O thread
+        bool returned;          // and the I/O thread is done with it
+        bool done;
+        uint64_t start_ticks;
+        uint64_t stall;         // cycles the core waits for this call
+
+        // stats, printed at the end
+        uint64_t host_calls;
+        uint64_t stall_cycles;
+        double host_seconds;
+
+        // shared with the I/O thread (allocated once and never freed, so exit doesn't race the thread)
+        mutex* lock;
+        condition_variable* wake;
+        bool has_work;
+        bool host_done;
+        double call_seconds;
+    } ecall_async;
+
+    static void ecall_io_thread() {
+        for(;;) {
+            unique_lock<mutex> guard(*ecall_async.lock);
+            ecall_async.wake->wait(guard, []{ return ecall_async.has_work; });
+            ecall_async.has_work = false;
+            guard.unlock();
+
+            int new_errno;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            long long ret = ecall_host(ecall_async.call, new_errno);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            guard.lock();
+            ecall_async.ret = ret;
+            ecall_async.new_errno = new_errno;
+            ecall_async.call_seconds = seconds;
+            ecall_async.host_done = true;
+        }
+    }
+
+    // Points the memory arguments of the call at private copies, so the I/O thread never touches
+    // guest memory (ecall_finish copies the result in). Only for calls that can't write past the
+    // ECALL_MEMGUARD bytes that were copied; returns false for the others, which run in place.
+    static bool ecall_bounce(ecall_call& c) {
+        long long buf, len;
+        switch(c.a7) {
+        case __NR_read:
+        case __NR_write:
+        case __NR_pread64:
+        case __NR_pwrite64:
+            buf = c.memargs[0].first;
+            len = c.a2;
+            break;
+        case __NR_nanosleep:
+        case __NR_clock_nanosleep:
+            buf = 0;
+            len = 0; // timespecs
+            break;
+        default:
+            return false;
+        }
+        if (len < 0 || (buf & 63) + len > ECALL_MEMGUARD) return false;
+
+        c.bounce.resize(c.memargs.size());
+        for(size_t m = 0; m < c.memargs.size(); ++m) {
+            c.bounce[m].first = c.memargs[m].first;
+            memcpy(c.bounce[m].second, c.memargs[m].second, ECALL_MEMGUARD);
+        }
+        long long* args[] = { &c.a0, &c.a1, &c.a2, &c.a3, &c.a4, &c.a5, &c.a6 };
+        for(size_t m = 0; m < c.memargs.size(); ++m)
+            for(auto a : args)
+                if (*a == c.memargs[m].first + (long long)System::sys->ram_virt)
+                    *a = (long long)&c.bounce[m].second[c.memargs[m].first & 63];
+        return true;
+    }
+
+    static void ecall_report() {
+        if (!ecall_async.host_calls) return;
+        cerr << "Async ecalls: " << std::dec << ecall_async.host_calls << " calls on the I/O thread, "
+             << ecall_async.host_seconds << " s host time, "
+             << ecall_async.stall_cycles << " cycles stalled" << endl;
+    }
+
+    void do_ecall_start(long long a7, long long a0, long long a1, long long a2, long long a3, long long a4, long long a5, long long a6) {
+        if (!ecall_async.checked_env) {
+            const char* ASYNC_ECALL = getenv("ASYNC_ECALL");
+            ecall_async.async = ASYNC_ECALL?(atoi(ASYNC_ECALL)!=0):0;
+            ecall_async.checked_env = true;
+            const char* ECALL_CYCLES = getenv("ECALL_CYCLES");
+            ecall_async.cost = !ECALL_CYCLES ? 0 : string(ECALL_CYCLES) == "host" ? -1 : atoll(ECALL_CYCLES);
+            if (ecall_async.async) {
+                ecall_async.lock = new mutex;
+                ecall_async.wake = new condition_variable;
+                thread(ecall_io_thread).detach();
+                atexit(ecall_report);
+            }
+        }
+
+        assert(!ecall_async.on_host);
+        ecall_async.done = false;
+        ecall_async.start_ticks = System::sys->ticks;
+        if (!ecall_async.async) {
+            do_ecall(a7, a0, a1, a2, a3, a4, a5, a6, &ecall_async.ret);
+            ecall_async.done = true;
+            return;
+        }
+
+        ecall_async.call = { a7, a0, a1, a2, a3, a4, a5, a6 };
+        if (ecall_prepare(ecall_async.call, &ecall_async.ret)) {
+            ecall_async.done = true;
+            return;
+        }
+        if (!ecall_bounce(ecall_async.call)) {
+            int new_errno;
+            ecall_async.ret = ecall_host(ecall_async.call, new_errno);
+            ecall_finish(ecall_async.call, new_errno);
+            ecall_async.done = true;
+            return;
+        }
+        ecall_async.on_host = true;
+        ecall_async.returned = false;
+        ecall_async.stall = ecall_async.cost;
+        lock_guard<mutex> guard(*ecall_async.lock);
+        ecall_async.host_done = false;
+        ecall_async.has_work = true;
+        ecall_async.wake->notify_one();
+    }
+
+    int do_ecall_done(long long* a0ret) {
+        if (ecall_async.on_host) {
+            uint64_t stalled = (System::sys->ticks - ecall_async.start_ticks) / System::sys->ps_per_clock;
+            if (!ecall_async.returned) {
+                lock_guard<mutex> guard(*ecall_async.lock);
+                if (!ecall_async.host_done) return 0;
+                ecall_async.returned = true;
+                if (ecall_async.cost < 0) ecall_async.stall = ecall_async.call_seconds * 1e12 / System::sys->ps_per_clock;
+            }
+            if (stalled < ecall_async.stall) return 0;
+            ecall_async.on_host = false;
+            ecall_async.host_calls++;
+            ecall_async.host_seconds += ecall_async.call_seconds;
+            ecall_async.stall_cycles += stalled;
+            if (ECALL_DEBUG) cerr << " => " << std::dec << ecall_async.ret << endl;
+            ecall_finish(ecall_async.call, ecall_async.new_errno);
+            ecall_async.done = true;
+        }
+        if (!ecall_async.done) return 0;
+        *a0ret = ecall_async.ret;
+        return 1;
+    }
+
 }
@@ -0,0 +1,518 @@
+module l2bank
+	#(
+		//Memory bus constants
+		BUS_DATA_WIDTH = 64,		//64, 128, 256 or 512, the same on both sides
+		BUS_TAG_WIDTH = 13,
+
+		//State values
+		INITIAL = 0,
+		ACCEPT = 1,
+		ACKPROC = 2,
+		READVAL = 3,
+		ACKVAL = 4,
+		LOOKUP = 5,
+		HITWAIT = 6,
+		DRAMRD = 7,
+		RECEIVE = 8,
+		UPDATE = 9,
+		RESPOND = 10,
+		DRAMWREQ = 11,
+		DRAMWRT = 12,
+		PFLOOKUP = 13,
+		PFRD = 14,
+
+		//Cache constants
+		OFFSET = 6,			//offset = log2(64) (# addresses in cache line)
+		DATA_LENGTH = 512,
+		LINE_BEATS = DATA_LENGTH / BUS_DATA_WIDTH,	//beats per line
+		BEAT_WORDS = BUS_DATA_WIDTH / 64,		//doublewords per beat
+		BANK_BITS = 1,			//log2 of the number of banks in the L2
+		BANK_ID = 0,			//lines whose address bits [OFFSET +: BANK_BITS] are BANK_ID live here
+		BANK_TAG_BIT = 3,		//memory requests carry BANK_ID here, so responses find their bank
+		NUM_SETS = 64,
+		SET_INDEX = 6,			//log2(NUM_SETS)
+		NUM_WAYS = 4,
+		WAY_BITS = 2,			//log2(NUM_WAYS)
+		NUM_CACHE_LINES = NUM_SETS * NUM_WAYS,
+		L2_TAG = 64 - OFFSET - BANK_BITS - SET_INDEX,
+
+		//Cycles spent in lookup before the first beat of a hit goes back to the arbiter.
+		HIT_LATENCY = 4
+	)
+	(
+		input  clk,
+		input reset,
+		output idle,					// 1 if nothing is in flight
+		output access,					// 1 for one cycle on each tag lookup (for the energy model)
+		output fill,					// 1 for one cycle on each line write (fill or write-through)
+
+		// requests from the arbiter, passed on by l2cache when they are for this bank
+		input p_bus_reqcyc,
+		output  p_bus_reqack,
+		input [BUS_DATA_WIDTH-1:0] p_bus_req,
+		input [BUS_TAG_WIDTH-1:0] p_bus_reqtag,
+		output p_bus_chan,				// 1 while this bank holds the request channel (ack, write data)
+
+		// responses to the arbiter, one bank at a time
+		output p_bus_respwant,				// 1 while a beat is waiting to go out
+		output p_bus_respbusy,				// 1 once the first beat of the line went out
+		input p_bus_respgrant,				// the response channel is this bank's
+		input p_bus_respack,
+		output  [BUS_DATA_WIDTH-1:0] p_bus_resp,
+		output  [BUS_TAG_WIDTH-1:0] p_bus_resptag,
+
+		// requests to memory, one bank at a time
+		output m_bus_reqcyc,
+		input  m_bus_reqack,				// only while l2cache gives this bank the memory side
+		output [BUS_DATA_WIDTH-1:0] m_bus_req,
+		output [BUS_TAG_WIDTH-1:0] m_bus_reqtag,
+		output m_bus_lock,				// sending write data, keep the memory side
+
+		// responses from memory (all of them, the bank takes the ones tagged with BANK_ID)
+		input  m_bus_respcyc,
+		output m_bus_respack,
+		input  [BUS_DATA_WIDTH-1:0] m_bus_resp,
+		input  [BUS_TAG_WIDTH-1:0] m_bus_resptag,
+
+		// prefetcher (shared by the banks, in l2cache)
+		output train,					// a demand read looked up train_addr
+		output [63:0] train_addr,
+		input pf_req,					// a prefetch of pf_addr (a line of this bank) is waiting
+		input [63:0] pf_addr,
+		output pf_take,					// this bank starts it
+
+		// statistics, counted in l2cache
+		output count_hit,
+		output count_miss,
+		output count_write,
+		output count_pf,
+		output count_pf_useful
+	);
+
+	//variables used in all states
+	logic [63:0] req_addr;
+	logic [63:0] _req_addr;
+	logic [12:0] req_tag;
+	logic [12:0] _req_tag;
+	logic [3:0] state;
+	logic [3:0] next_state;
+	logic [DATA_LENGTH-1:0] content;
+	logic [DATA_LENGTH-1:0] _content;
+	logic [8:0] ptr;
+	logic [8:0] next_ptr;
+	logic [2:0] beat;	//beat of the line on the bus now; lines move critical beat first like the system bus
+	logic [8:0] sent;	//beats of a missed line already passed on to the arbiter while the rest comes in
+	logic [8:0] _sent;
+	logic [2:0] sent_beat;	//the beat to pass on next
+	logic [7:0] latency_count;
+	logic [7:0] _latency_count;
+
+	//cache arrays of this bank
+	logic [NUM_CACHE_LINES-1:0] valid_bits;
+	logic [L2_TAG-1:0] l2_tags[NUM_CACHE_LINES-1:0];
+	logic [DATA_LENGTH-1:0] cache_data[NUM_CACHE_LINES-1:0];
+	logic [WAY_BITS-1:0] victim[NUM_SETS-1:0];	//round-robin replacement per set
+
+	//lookup variables (for req_addr)
+	logic [L2_TAG-1:0] lookup_tag;
+	logic [SET_INDEX-1:0] lookup_set;
+	logic [15:0] lookup_base;	//index of way 0 of the set
+	logic lookup_hit;
+	logic [15:0] lookup_index;
+
+	//the line to be filled in UPDATE
+	logic [15:0] fill_slot;
+	logic [15:0] _fill_slot;
+	logic fill_cancel;		//an invalidation hit the line while it was being filled
+	logic _fill_cancel;
+
+	//write enables for the arrays (only one line is written per cycle)
+	logic fill_en;
+	logic fill_new;			//1 if the fill replaces the set's victim
+	logic [15:0] fill_index;
+	logic [L2_TAG-1:0] fill_tag;
+	logic [DATA_LENGTH-1:0] fill_data;
+
+	//invalidation snooping
+	logic inv_en;
+	logic [15:0] inv_index;
+	logic [L2_TAG-1:0] inv_tag;
+	logic [15:0] inv_base;
+
+	logic prefetching;		//1 while the current request is a prefetch
+	logic _prefetching;
+	logic [NUM_CACHE_LINES-1:0] pf_bits;	//1 if the line was brought in by a prefetch and not yet used
+	logic mine;			//the response on the memory side is for this bank
+
+	assign idle = (state == ACCEPT);
+	assign access = (state == LOOKUP || state == PFLOOKUP);
+	assign fill = fill_en;
+	assign beat = (req_addr[5:3] / BEAT_WORDS + ptr[2:0]) % LINE_BEATS;
+	assign sent_beat = (req_addr[5:3] / BEAT_WORDS + sent[2:0]) % LINE_BEATS;
+	assign p_bus_chan = (state == ACKPROC || state == READVAL || state == ACKVAL);
+	assign m_bus_lock = (state == DRAMWRT);
+	assign mine = (m_bus_respcyc == 1 && m_bus_resptag != 12'h800 && m_bus_resptag[BANK_TAG_BIT +: BANK_BITS] == BANK_ID);
+	assign train_addr = req_addr;
+	assign count_pf_useful = count_hit && pf_bits[lookup_index];
+
+	//look up req_addr in all ways of its set
+	always_comb begin
+		lookup_tag = req_addr[63:63-L2_TAG+1];
+		lookup_set = req_addr[OFFSET+BANK_BITS +: SET_INDEX];
+		lookup_base = lookup_set*NUM_WAYS;
+		lookup_hit = 0;
+		lookup_index = lookup_base + victim[lookup_set];
+		for(int w = 0; w < NUM_WAYS; w++) begin
+			if(valid_bits[lookup_base + w] == 1 && l2_tags[lookup_base + w] == lookup_tag) begin
+				lookup_hit = 1;
+				lookup_index = lookup_base + w;
+			end
+		end
+	end
+
+	//snoop invalidations from the system (the processor acknowledges them, not us)
+	always_comb begin
+		inv_en = 0;
+		inv_tag = m_bus_resp[63:63-L2_TAG+1];
+		inv_base = m_bus_resp[OFFSET+BANK_BITS +: SET_INDEX]*NUM_WAYS;
+		inv_index = inv_base;
+		_fill_cancel = fill_cancel;
+		if(state == ACCEPT) begin
+			_fill_cancel = 0;
+		end
+		if(m_bus_respcyc == 1 && m_bus_resptag == 12'h800 && m_bus_resp[OFFSET +: BANK_BITS] == BANK_ID) begin
+			for(int w = 0; w < NUM_WAYS; w++) begin
+				if(valid_bits[inv_base + w] == 1 && l2_tags[inv_base + w] == inv_tag) begin
+					inv_en = 1;
+					inv_index = inv_base + w;
+				end
+			end
+			if((state == RECEIVE || state == UPDATE) && (m_bus_resp[63:OFFSET] == req_addr[63:OFFSET])) begin
+				_fill_cancel = 1;
+			end
+		end
+	end
+
+	//NOTE: multiple always comb blocks used to keep verilator happy (same as in cache.sv)
+	//	arbiter resp, ack, and cyc variables cannot be set or used within the same block
+
+	//accept requests from the arbiter: INITIAL, ACCEPT
+	always_comb begin
+		pf_take = 0;
+		case(state)
+			INITIAL: begin
+					next_state = ACCEPT;
+				end
+			ACCEPT: begin
+					//wait for requests from the arbiter. Demand requests go before prefetches.
+					_req_addr = p_bus_req[63:0];
+					_req_tag = p_bus_reqtag;
+					_prefetching = 0;
+					next_ptr = 0;
+					if(p_bus_reqcyc == 1) begin
+						next_state = ACKPROC;
+					end
+					else if(pf_req == 1) begin
+						pf_take = 1;
+						_req_addr = pf_addr - (pf_addr % 64);
+						_req_tag = {`SYSBUS_READ,`SYSBUS_MEMORY,`SYSBUS_PREFETCH};
+						_prefetching = 1;
+						next_state = PFLOOKUP;
+					end
+					else begin
+						next_state = ACCEPT;
+					end
+				end
+		endcase
+	end
+
+	//acknowledge receiving request and values from the arbiter: ACKPROC, ACKVAL
+	always_comb begin
+		p_bus_reqack = 0;
+		case(state)
+			ACKPROC: begin
+					p_bus_reqack = 1;
+					if(req_tag[12] == `SYSBUS_WRITE) begin
+						next_state = READVAL;
+					end
+					else begin
+						next_state = LOOKUP;
+					end
+				end
+			ACKVAL: begin
+					p_bus_reqack = 1;
+					next_ptr = ptr + 1;
+					if(ptr == LINE_BEATS-1) begin
+						next_state = LOOKUP;
+						next_ptr = 0;
+					end
+					else begin
+						next_state = READVAL;
+					end
+				end
+		endcase
+	end
+
+	//read values, look up, fill and write through to memory:
+	//READVAL, LOOKUP, HITWAIT, DRAMRD, RECEIVE, UPDATE, DRAMWREQ, DRAMWRT, PFLOOKUP, PFRD
+	always_comb begin
+		m_bus_reqcyc = 0;
+		m_bus_respack = 0;
+		m_bus_reqtag = req_tag;
+		m_bus_reqtag[BANK_TAG_BIT +: BANK_BITS] = BANK_ID;
+		_content = content;
+		_latency_count = latency_count;
+		_fill_slot = fill_slot;
+		fill_en = 0;
+		fill_new = 0;
+		fill_index = fill_slot;
+		fill_tag = req_addr[63:63-L2_TAG+1];
+		fill_data = content;
+		train = 0;
+		count_hit = 0;
+		count_miss = 0;
+		count_write = 0;
+		count_pf = 0;
+
+		case(state)
+			READVAL: begin
+					//read value to be written from the arbiter (_content is only written in this block)
+					if(p_bus_reqcyc == 1) begin
+						_content[BUS_DATA_WIDTH*ptr +: BUS_DATA_WIDTH] = p_bus_req;
+						next_state = ACKVAL;
+					end
+					else begin
+						next_state = READVAL;
+					end
+				end
+			LOOKUP: begin
+					if(req_tag[12] == `SYSBUS_WRITE) begin
+						//the whole line is given on writes, so update (or allocate) it and write through
+						count_write = 1;
+						fill_en = 1;
+						fill_new = !lookup_hit;
+						fill_index = lookup_index;
+						fill_tag = lookup_tag;
+						next_state = DRAMWREQ;
+					end
+					else begin
+						if(lookup_hit == 1) begin
+							count_hit = 1;
+							_content = cache_data[lookup_index];
+							if(HIT_LATENCY > 1) begin
+								_latency_count = HIT_LATENCY - 1;
+								next_state = HITWAIT;
+							end
+							else begin
+								next_state = RESPOND;
+							end
+						end
+						else begin
+							count_miss = 1;
+							_content = 0;
+							_fill_slot = lookup_index;
+							next_state = DRAMRD;
+						end
+
+						//train the prefetcher on every demand read
+						train = 1;
+					end
+				end
+			HITWAIT: begin
+					_latency_count = latency_count - 1;
+					if(latency_count <= 1) begin
+						next_state = RESPOND;
+					end
+					else begin
+						next_state = HITWAIT;
+					end
+				end
+			DRAMRD: begin
+					//send request to memory
+					m_bus_reqcyc = 1;
+					m_bus_req = req_addr;
+					if(m_bus_reqack == 1) begin
+						next_ptr = 0;
+						next_state = RECEIVE;
+					end
+					else begin
+						next_state = DRAMRD;
+					end
+				end
+			RECEIVE: begin
+					//receive reponse from memory. Invalidations are left on the bus for the processor.
+					if(mine) begin
+						m_bus_respack = 1;
+						_content[BUS_DATA_WIDTH*beat +: BUS_DATA_WIDTH] = m_bus_resp;
+						next_ptr = ptr + 1;
+						if(ptr == LINE_BEATS-1) begin
+							next_ptr = 0;
+							next_state = UPDATE;
+						end
+						else begin
+							next_state = RECEIVE;
+						end
+					end
+					else begin
+						next_state = RECEIVE;
+					end
+				end
+			UPDATE: begin
+					//insert the new block into the cache
+					if(_fill_cancel == 0) begin
+						fill_en = 1;
+						fill_new = 1;
+					end
+					//the beats passed on in RECEIVE aren't sent again
+					next_ptr = sent;
+					if(prefetching == 1) begin
+						next_state = ACCEPT;
+					end
+					else begin
+						next_state = RESPOND;
+					end
+				end
+			DRAMWREQ: begin
+					m_bus_reqcyc = 1;
+					m_bus_req = req_addr;
+					if(m_bus_reqack == 1) begin
+						next_ptr = 0;
+						next_state = DRAMWRT;
+					end
+					else begin
+						next_state = DRAMWREQ;
+					end
+				end
+			DRAMWRT: begin
+					m_bus_reqcyc = 1;
+					m_bus_req = content[BUS_DATA_WIDTH*ptr +: BUS_DATA_WIDTH];
+					if(m_bus_reqack == 1) begin
+						next_ptr = ptr + 1;
+						if(ptr == LINE_BEATS-1) begin
+							next_ptr = 0;
+							next_state = ACCEPT;
+						end
+						else begin
+							next_state = DRAMWRT;
+						end
+					end
+					else begin
+						next_state = DRAMWRT;
+					end
+				end
+			PFLOOKUP: begin
+					//drop the prefetch if the line is already here
+					if(lookup_hit == 1) begin
+						next_state = ACCEPT;
+					end
+					else begin
+						_fill_slot = lookup_index;
+						next_state = PFRD;
+					end
+				end
+			PFRD: begin
+					m_bus_reqcyc = 1;
+					m_bus_req = req_addr;
+					if(m_bus_reqack == 1) begin
+						count_pf = 1;
+						_content = 0;
+						next_ptr = 0;
+						next_state = RECEIVE;
+					end
+					else begin
+						next_state = PFRD;
+					end
+				end
+		endcase
+	end
+
+	//respond to the arbiter one beat per acknowledged cycle, like the system bus does: RESPOND.
+	//On a demand miss, each beat goes on to the arbiter the cycle after it came in from memory
+	//(critical beat first), so the L1 can restart early without waiting for the whole line.
+	always_comb begin
+		p_bus_respwant = (state == RESPOND) || (state == RECEIVE && prefetching == 0 && sent < ptr);
+		p_bus_respbusy = (state == RESPOND && ptr != 0) || ((state == RECEIVE || state == UPDATE) && sent != 0);
+		if(state == RESPOND) begin
+			p_bus_resp = content[BUS_DATA_WIDTH*beat +: BUS_DATA_WIDTH];
+		end
+		else begin
+			p_bus_resp = content[BUS_DATA_WIDTH*sent_beat +: BUS_DATA_WIDTH];
+		end
+		p_bus_resptag = req_tag;
+	end
+
+	//determine if the arbiter received the beat: RECEIVE, RESPOND
+	always_comb begin
+		_sent = sent;
+		if(state == ACCEPT) begin
+			_sent = 0;
+		end
+		if(state == RECEIVE && prefetching == 0 && sent < ptr && p_bus_respgrant == 1 && p_bus_respack == 1) begin
+			_sent = sent + 1;
+		end
+		case(state)
+			RESPOND: begin
+					next_ptr = ptr;
+					next_state = RESPOND;
+					if(p_bus_respgrant == 1 && p_bus_respack == 1) begin
+						next_ptr = ptr + 1;
+						if(ptr == LINE_BEATS-1) begin
+							next_ptr = 0;
+							next_state = ACCEPT;
+						end
+					end
+				end
+		endcase
+	end
+
+	always_ff @ (posedge clk) begin
+		if(reset) begin
+			state <= INITIAL;
+			req_addr <= 0;
+			req_tag <= 0;
+			content <= 0;
+			ptr <= 0;
+			sent <= 0;
+			latency_count <= 0;
+			valid_bits <= 0;
+			pf_bits <= 0;
+			fill_cancel <= 0;
+			prefetching <= 0;
+			for(int i = 0; i < NUM_SETS; i++) begin
+				victim[i] <= 0;
+			end
+		end else begin
+
+		//write values from wires to register
+		state <= next_state;
+		req_addr <= _req_addr;
+		req_tag <= _req_tag;
+		content <= _content;
+		ptr <= next_ptr;
+		sent <= _sent;
+		latency_count <= _latency_count;
+		fill_slot <= _fill_slot;
+		fill_cancel <= _fill_cancel;
+		prefetching <= _prefetching;
+
+		//only the line being filled is written, the arrays are too big to copy every cycle
+		if(fill_en) begin
+			valid_bits[fill_index] <= 1;
+			l2_tags[fill_index] <= fill_tag;
+			cache_data[fill_index] <= fill_data;
+			pf_bits[fill_index] <= prefetching;
+			if(fill_new) begin
+				victim[fill_index/NUM_WAYS] <= victim[fill_index/NUM_WAYS] + 1;
+			end
+		end
+		if(inv_en) begin
+			valid_bits[inv_index] <= 0;
+		end
+		if(count_pf_useful) begin
+			pf_bits[lookup_index] <= 0;
+		end
+
+		end
+	end
+
+endmodule
@@ -0,0 +1,271 @@
+module l2cache
+	#(
+		//Memory bus constants
+		BUS_DATA_WIDTH = 64,		//64, 128, 256 or 512, the same on both sides
+		BUS_TAG_WIDTH = 13,
+
+		//Cache constants
+		OFFSET = 6,			//offset = log2(64) (# addresses in cache line)
+		NUM_BANKS = 2,			//lines are interleaved across banks by the lowest line address bits
+		BANK_BITS = 1,			//log2(NUM_BANKS), at least 1
+		BANK_TAG_BIT = 3,		//memory requests carry the bank number from this tag bit up
+		NUM_SETS = 64,			//sets per bank
+		SET_INDEX = 6,			//log2(NUM_SETS)
+		NUM_WAYS = 4,
+		WAY_BITS = 2,			//log2(NUM_WAYS)
+		// NUM_BANKS*NUM_SETS*NUM_WAYS lines of 64 bytes: 2*64*4 = 32KB
+
+		//Cycles spent in lookup before the first beat of a hit goes back to the arbiter.
+		HIT_LATENCY = 4,
+
+		//Prefetcher: 0 = off, 1 = next-line, 2 = stride (falls back to next-line)
+		PREFETCH = 2,
+		PREFETCH_DISTANCE = 1,		//how many strides ahead of the demand access to prefetch
+		STRIDE_ENTRIES = 4,		//stride table entries, indexed by 4KB page
+		STRIDE_INDEX = 2		//log2(STRIDE_ENTRIES)
+	)
+	(
+		input  clk,
+		input reset,
+		output ready,					// 1 if nothing is in flight (used before ecalls)
+		output [3:0] access,				// tag lookups this cycle (for the energy model)
+		output [3:0] fill,				// line writes (fill or write-through) this cycle
+
+		// interface to connect to the arbiter
+		input p_bus_reqcyc,				//set to 1 when a read/write is requested
+		output  p_bus_reqack,				//acknowledgement of request from the arbiter
+		input [BUS_DATA_WIDTH-1:0] p_bus_req,		//the address (or data on writes)
+		input [BUS_TAG_WIDTH-1:0] p_bus_reqtag,		//tag associated with request
+
+		output  p_bus_respcyc,				//set to 1 while a response beat is on the bus
+		input p_bus_respack, 				//acknowledgement by the arbiter when receiving the beat
+		output  [BUS_DATA_WIDTH-1:0] p_bus_resp,	//content of requested address
+		output  [BUS_TAG_WIDTH-1:0] p_bus_resptag,	//tag associated with response
+
+		// interface to connect to the system bus (dram side)
+		output m_bus_reqcyc,				//set to 1 to request a read/write from memory
+		input  m_bus_reqack,				//acknowledgement by memory when request received
+		output [BUS_DATA_WIDTH-1:0] m_bus_req,		//the address (or data on writes)
+		output [BUS_TAG_WIDTH-1:0] m_bus_reqtag,	//tag associated with request
+
+		input  m_bus_respcyc,				//set to 1 when memory has a response
+		output m_bus_respack,				//acknowlegement of response sent to memory
+		input  [BUS_DATA_WIDTH-1:0] m_bus_resp,		//the contents of the requested address
+		input  [BUS_TAG_WIDTH-1:0] m_bus_resptag	//tag associated with response
+	);
+
+	//Each bank has its own state machine, so while one bank waits for memory
+	//(an I-cache miss, say) another one can take the next request from the arbiter
+	//(a D-cache miss to a line of that bank). This module sends the arbiter's requests
+	//to the bank of their line, lets one bank at a time use the memory request channel
+	//and the response channel to the arbiter, and hands memory responses back by the
+	//bank number in their tag. The prefetcher is shared, since the next line is usually
+	//in another bank.
+
+	//per bank
+	logic [NUM_BANKS-1:0] bank_idle;
+	logic [NUM_BANKS-1:0] bank_access;
+	logic [NUM_BANKS-1:0] bank_fill;
+	logic [NUM_BANKS-1:0] bank_reqcyc;
+	logic [NUM_BANKS-1:0] bank_reqack;
+	logic [NUM_BANKS-1:0] bank_chan;
+	logic [NUM_BANKS-1:0] bank_respwant;
+	logic [NUM_BANKS-1:0] bank_respbusy;
+	logic [NUM_BANKS-1:0] bank_respgrant;
+	logic [BUS_DATA_WIDTH-1:0] bank_resp[NUM_BANKS-1:0];
+	logic [BUS_TAG_WIDTH-1:0] bank_resptag[NUM_BANKS-1:0];
+	logic [NUM_BANKS-1:0] bank_m_reqcyc;
+	logic [NUM_BANKS-1:0] bank_m_reqack;
+	logic [NUM_BANKS-1:0] bank_m_lock;
+	logic [NUM_BANKS-1:0] bank_m_respack;
+	logic [BUS_DATA_WIDTH-1:0] bank_m_req[NUM_BANKS-1:0];
+	logic [BUS_TAG_WIDTH-1:0] bank_m_reqtag[NUM_BANKS-1:0];
+	logic [NUM_BANKS-1:0] bank_train;
+	logic [63:0] bank_train_addr[NUM_BANKS-1:0];
+	logic [NUM_BANKS-1:0] bank_pf_req;
+	logic [NUM_BANKS-1:0] bank_pf_take;
+	logic [NUM_BANKS-1:0] bank_hit;
+	logic [NUM_BANKS-1:0] bank_miss;
+	logic [NUM_BANKS-1:0] bank_write;
+	logic [NUM_BANKS-1:0] bank_pf;
+	logic [NUM_BANKS-1:0] bank_pf_useful;
+
+	//routing
+	logic [BANK_BITS-1:0] req_bank;		//bank of the line the arbiter asks for
+	logic [BANK_BITS-1:0] resp_bank;	//bank that has the response channel
+	logic [BANK_BITS-1:0] m_bank;		//bank that has the memory request channel
+
+	//prefetcher
+	logic pf_pending;
+	logic _pf_pending;
+	logic [63:0] pf_addr;
+	logic [63:0] _pf_addr;
+	logic [63:0] train_addr;
+	logic [63:0] st_last_line[STRIDE_ENTRIES-1:0];
+	logic [63:0] _st_last_line[STRIDE_ENTRIES-1:0];
+	logic signed [63:0] st_stride[STRIDE_ENTRIES-1:0];
+	logic signed [63:0] _st_stride[STRIDE_ENTRIES-1:0];
+	logic [STRIDE_INDEX-1:0] st_index;
+	logic signed [63:0] st_delta;
+
+	//statistics, printed at the end of simulation
+	logic [63:0] stat_hits;
+	logic [63:0] stat_misses;
+	logic [63:0] stat_writes;
+	logic [63:0] stat_pf_issued;
+	logic [63:0] stat_pf_useful;
+
+	genvar b;
+	generate
+		for(b = 0; b < NUM_BANKS; b++) begin : bank_gen
+			l2bank #(.BUS_DATA_WIDTH(BUS_DATA_WIDTH), .BUS_TAG_WIDTH(BUS_TAG_WIDTH), .OFFSET(OFFSET),
+				 .BANK_BITS(BANK_BITS), .BANK_ID(b), .BANK_TAG_BIT(BANK_TAG_BIT),
+				 .NUM_SETS(NUM_SETS), .SET_INDEX(SET_INDEX), .NUM_WAYS(NUM_WAYS), .WAY_BITS(WAY_BITS),
+				 .HIT_LATENCY(HIT_LATENCY)) bank_mod (
+				//INPUTS
+				.clk(clk), .reset(reset),
+				.p_bus_reqcyc(bank_reqcyc[b]), .p_bus_req(p_bus_req), .p_bus_reqtag(p_bus_reqtag),
+				.p_bus_respgrant(bank_respgrant[b]), .p_bus_respack(p_bus_respack),
+				.m_bus_reqack(bank_m_reqack[b]), .m_bus_respcyc(m_bus_respcyc),
+				.m_bus_resp(m_bus_resp), .m_bus_resptag(m_bus_resptag),
+				.pf_req(bank_pf_req[b]), .pf_addr(pf_addr),
+
+				//OUTPUTS
+				.idle(bank_idle[b]), .access(bank_access[b]), .fill(bank_fill[b]),
+				.p_bus_reqack(bank_reqack[b]), .p_bus_chan(bank_chan[b]),
+				.p_bus_respwant(bank_respwant[b]), .p_bus_respbusy(bank_respbusy[b]),
+				.p_bus_resp(bank_resp[b]), .p_bus_resptag(bank_resptag[b]),
+				.m_bus_reqcyc(bank_m_reqcyc[b]), .m_bus_req(bank_m_req[b]), .m_bus_reqtag(bank_m_reqtag[b]),
+				.m_bus_lock(bank_m_lock[b]), .m_bus_respack(bank_m_respack[b]),
+				.train(bank_train[b]), .train_addr(bank_train_addr[b]), .pf_take(bank_pf_take[b]),
+				.count_hit(bank_hit[b]), .count_miss(bank_miss[b]), .count_write(bank_write[b]),
+				.count_pf(bank_pf[b]), .count_pf_useful(bank_pf_useful[b])
+			);
+		end
+	endgenerate
+
+	//NOTE: multiple always comb blocks used to keep verilator happy (same as in cache.sv)
+	//	what goes to the banks and what comes back from them are not set in the same block
+
+	//the request goes to the bank of its line; write data goes to the bank that took the write
+	always_comb begin
+		req_bank = p_bus_req[OFFSET +: BANK_BITS];
+		for(int i = 0; i < NUM_BANKS; i++) begin
+			bank_reqcyc[i] = p_bus_reqcyc && (bank_chan[i] || (bank_chan == 0 && req_bank == i));
+		end
+	end
+
+	//the response channel stays with a bank until its whole line is sent, then goes to the lowest bank waiting
+	always_comb begin
+		resp_bank = 0;
+		for(int i = NUM_BANKS-1; i >= 0; i--) begin
+			if(bank_respwant[i]) resp_bank = i;
+		end
+		for(int i = 0; i < NUM_BANKS; i++) begin
+			if(bank_respbusy[i]) resp_bank = i;
+		end
+		bank_respgrant = 0;
+		bank_respgrant[resp_bank] = 1;
+	end
+
+	//so does the memory request channel while a bank sends the data of a write
+	always_comb begin
+		m_bank = 0;
+		for(int i = NUM_BANKS-1; i >= 0; i--) begin
+			if(bank_m_reqcyc[i]) m_bank = i;
+		end
+		for(int i = 0; i < NUM_BANKS; i++) begin
+			if(bank_m_lock[i]) m_bank = i;
+		end
+		bank_m_reqack = 0;
+		bank_m_reqack[m_bank] = m_bus_reqack;
+	end
+
+	always_comb begin
+		p_bus_reqack = (bank_reqack != 0);
+		p_bus_respcyc = bank_respwant[resp_bank];
+		p_bus_resp = bank_resp[resp_bank];
+		p_bus_resptag = bank_resptag[resp_bank];
+		m_bus_reqcyc = (bank_m_reqcyc != 0);
+		m_bus_req = bank_m_req[m_bank];
+		m_bus_reqtag = bank_m_reqtag[m_bank];
+		m_bus_respack = (bank_m_respack != 0);
+		ready = (bank_idle == {NUM_BANKS{1'b1}}) && !pf_pending;
+		access = $countones(bank_access);
+		fill = $countones(bank_fill);
+	end
+
+	//offer the prefetch to the bank of its line
+	always_comb begin
+		for(int i = 0; i < NUM_BANKS; i++) begin
+			bank_pf_req[i] = pf_pending && pf_addr[OFFSET +: BANK_BITS] == i;
+		end
+	end
+
+	//train the prefetcher on demand reads (the lowest bank if two look up at once)
+	always_comb begin
+		_pf_pending = pf_pending;
+		_pf_addr = pf_addr;
+		for(int i = 0; i < STRIDE_ENTRIES; i++) begin
+			_st_last_line[i] = st_last_line[i];
+			_st_stride[i] = st_stride[i];
+		end
+		train_addr = 0;
+		for(int i = NUM_BANKS-1; i >= 0; i--) begin
+			if(bank_train[i]) train_addr = bank_train_addr[i];
+		end
+		st_index = train_addr[12 +: STRIDE_INDEX];
+		st_delta = train_addr[63:OFFSET] - st_last_line[st_index];
+
+		if(bank_pf_take != 0) begin
+			_pf_pending = 0;
+		end
+		if(PREFETCH != 0 && bank_train != 0) begin
+			_pf_addr = train_addr + 64*PREFETCH_DISTANCE;
+			if(PREFETCH == 2 && st_delta != 0 && st_delta == st_stride[st_index]) begin
+				_pf_addr = train_addr + 64*st_delta*PREFETCH_DISTANCE;
+			end
+			//only within the page of the demand read, so it can't go past the end of memory
+			_pf_pending = (_pf_addr[63:12] == train_addr[63:12]);
+			_st_last_line[st_index] = train_addr[63:OFFSET];
+			_st_stride[st_index] = st_delta;
+		end
+	end
+
+	always_ff @ (posedge clk) begin
+		if(reset) begin
+			pf_pending <= 0;
+			pf_addr <= 0;
+			for(int i = 0; i < STRIDE_ENTRIES; i++) begin
+				st_last_line[i] <= 0;
+				st_stride[i] <= 0;
+			end
+			stat_hits <= 0;
+			stat_misses <= 0;
+			stat_writes <= 0;
+			stat_pf_issued <= 0;
+			stat_pf_useful <= 0;
+		end else begin
+
+		pf_pending <= _pf_pending;
+		pf_addr <= _pf_addr;
+		for(int i = 0; i < STRIDE_ENTRIES; i++) begin
+			st_last_line[i] <= _st_last_line[i];
+			st_stride[i] <= _st_stride[i];
+		end
+
+		stat_hits <= stat_hits + $countones(bank_hit);
+		stat_misses <= stat_misses + $countones(bank_miss);
+		stat_writes <= stat_writes + $countones(bank_write);
+		stat_pf_issued <= stat_pf_issued + $countones(bank_pf);
+		stat_pf_useful <= stat_pf_useful + $countones(bank_pf_useful);
+
+		end
+	end
+
+	final begin
+		$display("L2: %0d read hits, %0d read misses, %0d writes, %0d prefetches issued, %0d useful",
+			stat_hits, stat_misses, stat_writes, stat_pf_issued, stat_pf_useful);
+	end
+
+endmodule
@@ -22,8 +22,11 @@ int main(int argc, char* argv[]) {
 	const char* ramelf = NULL;
 	if (argc > 0) ramelf = argv[1];
 
+	const char* PS_PER_CLOCK = getenv("PS_PER_CLOCK");
+	int ps_per_clock = PS_PER_CLOCK?atoi(PS_PER_CLOCK):500;
+
 	Vtop top;
-	System sys(&top, RAM_SIZE, ramelf, argc-1, argv+1, 500);
+	System sys(&top, RAM_SIZE, ramelf, argc-1, argv+1, ps_per_clock);
 
 	// (argc, argv) sanity check
 	cerr << "===== Printing arguments of the program..." << endl;
@@ -89,6 +92,10 @@ int main(int argc, char* argv[]) {
 
 	top.final();
 
+	uint64_t cycles = sys.ticks/sys.ps_per_clock;
+	cerr << dec << "Simulation: " << cycles << " cycles, " << sys.instructions << " instructions, IPC "
+	     << (cycles ? (double)sys.instructions/cycles : 0) << endl;
+
 #if VM_TRACE
 	if (tfp) tfp->close();
 	delete tfp;
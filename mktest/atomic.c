@@ -0,0 +1,123 @@
+/* Atomics (RV64A): a free-list allocator behind an LR/SC spinlock, and every AMO on 32- and
+   64-bit words. The benchmark is single-threaded, so the results don't depend on timing. */
+#include "bench.h"
+
+#define BLOCKS 64
+#define SLOTS  16
+#define ROUNDS 4000
+#define AMO_ROUNDS 512
+
+#ifdef BENCH_HOST
+#define AMO_FN(name, insn, type, op) \
+  static type name(type* p, type v) { type o = *p; *p = (op); return o; }
+static long lr_sc_w(int* p, int v) { *p = v; return 0; }
+static long sc_w(int* p, int v) { return 1; }
+#else
+#define AMO_FN(name, insn, type, op) \
+  static type name(type* p, type v) { \
+    type o; \
+    asm volatile(insn " %0, %2, (%1)" : "=r"(o) : "r"(p), "r"(v) : "memory"); \
+    return o; \
+  }
+/* a reserved store right after its load succeeds */
+static long lr_sc_w(int* p, int v) {
+  long r;
+  asm volatile("lr.w %0, (%1)\n\tsc.w %0, %2, (%1)" : "=&r"(r) : "r"(p), "r"(v) : "memory");
+  return r;
+}
+/* with no reservation (the last SC dropped it) the store fails and writes nothing */
+static long sc_w(int* p, int v) {
+  long r;
+  asm volatile("sc.w %0, %2, (%1)" : "=r"(r) : "r"(p), "r"(v) : "memory");
+  return r;
+}
+#endif
+
+/* no builtins for these, so they are asm on the target */
+AMO_FN(amomin_d, "amomin.d", int64_t, v < o ? v : o)
+AMO_FN(amomaxu_d, "amomaxu.d", uint64_t, v > o ? v : o)
+AMO_FN(amomin_w, "amomin.w", int32_t, v < o ? v : o)
+AMO_FN(amomaxu_w, "amomaxu.w", uint32_t, v > o ? v : o)
+
+struct block {
+  struct block* next;
+  uint64_t data[3];
+};
+
+static struct block pool[BLOCKS];
+static struct block* free_list;
+static int heap_lock;
+static uint64_t allocs;
+static uint32_t frees;
+
+/* compare-and-swap loop, which is an LR/SC pair */
+static void lock_take(int* l) {
+  int expected;
+  do {
+    expected = 0;
+  } while (!__atomic_compare_exchange_n(l, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+}
+
+static void lock_give(int* l) {
+  __atomic_store_n(l, 0, __ATOMIC_RELEASE);
+}
+
+static struct block* blk_alloc(void) {
+  lock_take(&heap_lock);
+  struct block* b = free_list;
+  if (b) free_list = b->next;
+  lock_give(&heap_lock);
+  if (b) __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+  return b;
+}
+
+static void blk_free(struct block* b) {
+  lock_take(&heap_lock);
+  b->next = free_list;
+  free_list = b;
+  lock_give(&heap_lock);
+  __atomic_fetch_add(&frees, 1, __ATOMIC_RELAXED);
+}
+
+int bench_main(void) {
+  struct block* live[SLOTS];
+  uint64_t sum = 0;
+  for (int i = 0; i < BLOCKS; ++i) blk_free(&pool[i]);
+  for (int i = 0; i < SLOTS; ++i) live[i] = 0;
+  for (int r = 0; r < ROUNDS; ++r) {
+    int k = lcg() % SLOTS;
+    if (live[k]) {
+      sum += live[k]->data[0];
+      blk_free(live[k]);
+      live[k] = 0;
+    } else {
+      live[k] = blk_alloc();
+      live[k]->data[0] = lcg();
+      sum ^= (uint64_t)(live[k] - pool) << (r % 32);
+    }
+  }
+  check("heap", sum + allocs*1000 + frees, 0x0000003196e0eeb3);
+
+  uint64_t d = 0x0123456789abcdefULL, acc = 0;
+  uint32_t w = 0x89abcdefu;
+  for (int i = 0; i < AMO_ROUNDS; ++i) {
+    uint64_t v = ((uint64_t)lcg() << 32) | lcg();
+    acc = acc*31 + __atomic_fetch_add(&d, v, __ATOMIC_RELAXED);
+    acc = acc*31 + __atomic_fetch_xor(&d, v >> 3, __ATOMIC_RELAXED);
+    acc = acc*31 + __atomic_fetch_and(&d, ~(v << 5), __ATOMIC_RELAXED);
+    acc = acc*31 + __atomic_fetch_or(&d, v & 0x5555, __ATOMIC_RELAXED);
+    acc = acc*31 + __atomic_exchange_n(&d, d ^ (v << 17), __ATOMIC_RELAXED);
+    acc = acc*31 + amomin_d((int64_t*)&d, (int64_t)(v << 20));
+    acc = acc*31 + amomaxu_d(&d, v >> 1);
+    acc = acc*31 + (uint32_t)amomin_w((int32_t*)&w, (int32_t)(v << 7));
+    acc = acc*31 + amomaxu_w(&w, (uint32_t)(v >> 40));
+    acc = acc*31 + __atomic_fetch_add(&w, (uint32_t)v, __ATOMIC_RELAXED);
+  }
+  check("amo", acc ^ d ^ w, 0x53e708e4ca50f549);
+
+  int x = 7;
+  long ok = lr_sc_w(&x, 9);
+  long failed = sc_w(&x, 11);
+  check("lrsc", (ok == 0) + 2*(failed != 0) + 4*x, 1 + 2 + 4*9);
+  return bench_finish("atomic");
+}
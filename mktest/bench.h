@@ -0,0 +1,101 @@
+/* Support code for the benchmarks: system calls, printing, self-checks and _start.
+   The simulator passes ecalls to the host, so the call numbers are the x86-64 ones.
+   Build with -DBENCH_HOST to run a benchmark natively (to work out its expected values). */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+#define SYS_read   0
+#define SYS_write  1
+#define SYS_open   2
+#define SYS_close  3
+#define SYS_lseek  8
+#define SYS_nanosleep 35
+#define SYS_exit   60
+#define SYS_unlink 87
+
+#ifdef BENCH_HOST
+#include <unistd.h>
+#define bench_syscall(n, a, b, c) syscall(n, a, b, c)
+#else
+static inline long bench_syscall(long n, long a, long b, long c) {
+  register long a0 asm("a0") = a;
+  register long a1 asm("a1") = b;
+  register long a2 asm("a2") = c;
+  register long a7 asm("a7") = n;
+  asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a2), "r"(a7) : "memory");
+  return a0;
+}
+#endif
+
+static int bench_failures;
+
+static void print_str(const char* s) {
+  long n = 0;
+  while (s[n]) ++n;
+  bench_syscall(SYS_write, 1, (long)s, n);
+}
+
+static void print_hex(uint64_t v) {
+  char buf[19];
+  buf[0] = '0';
+  buf[1] = 'x';
+  for (int i = 0; i < 16; ++i)
+    buf[17-i] = "0123456789abcdef"[(v >> (4*i)) & 15];
+  buf[18] = 0;
+  print_str(buf);
+}
+
+/* prints "name: got" and counts a failure when it isn't what was expected */
+static void check(const char* name, uint64_t got, uint64_t expected) {
+  print_str(name);
+  print_str(": ");
+  print_hex(got);
+  if (got != expected) {
+    print_str(" FAIL, expected ");
+    print_hex(expected);
+    ++bench_failures;
+  }
+  print_str("\n");
+}
+
+/* small deterministic generator, so the inputs are the same on every run */
+static uint32_t lcg_state = 12345;
+static inline uint32_t lcg(void) {
+  lcg_state = lcg_state * 1103515245u + 12345u;
+  return lcg_state >> 8;
+}
+
+/* -O2 can turn loops into calls to these even with -fno-builtin */
+void* memset(void* d, int c, unsigned long n) {
+  unsigned char* p = d;
+  while (n--) *p++ = (unsigned char)c;
+  return d;
+}
+
+void* memcpy(void* d, const void* s, unsigned long n) {
+  unsigned char* p = d;
+  const unsigned char* q = s;
+  while (n--) *p++ = *q++;
+  return d;
+}
+
+int bench_main(void);
+
+static int bench_finish(const char* name) {
+  print_str(name);
+  print_str(bench_failures ? ": FAIL\n" : ": PASS\n");
+  return bench_failures != 0;
+}
+
+#ifdef BENCH_HOST
+int main(void) { return bench_main(); }
+#else
+void __attribute__((section(".text.start"), noreturn)) _start(void) {
+  bench_syscall(SYS_exit, bench_main(), 0, 0);
+  for (;;);
+}
+#endif
+
+#endif
@@ -0,0 +1,160 @@
+/* Dhrystone-style loop: record copies, string compares, small procedure calls,
+   a switch-based state machine and a CRC over the state, CoreMark fashion. */
+#include "bench.h"
+
+#define LOOPS 2000
+
+enum kind { IDENT_1, IDENT_2, IDENT_3, IDENT_4, IDENT_5 };
+
+struct record {
+  struct record* ptr;
+  enum kind discr;
+  enum kind enum_comp;
+  int int_comp;
+  char str_comp[31];
+};
+
+static struct record rec_a, rec_b;
+static int arr_1[50];
+static int arr_2[50][50];
+static char str_1[31], str_2[31];
+static int int_glob;
+static char char_glob;
+
+static void str_copy(char* d, const char* s) {
+  while ((*d++ = *s++));
+}
+
+static int str_cmp(const char* x, const char* y) {
+  while (*x && *x == *y) {
+    ++x;
+    ++y;
+  }
+  return (unsigned char)*x - (unsigned char)*y;
+}
+
+static enum kind func_1(char c1, char c2) {
+  if (c1 != c2) return IDENT_1;
+  char_glob = c1;
+  return IDENT_2;
+}
+
+static int func_2(const char* s1, const char* s2) {
+  int i = 2;
+  char c = 'A';
+  while (i <= 2) {
+    if (func_1(s1[i], s2[i+1]) == IDENT_1) {
+      c = 'A';
+      ++i;
+    }
+  }
+  if (c >= 'W' && c < 'Z') i = 7;
+  if (c == 'R') return 1;
+  if (str_cmp(s1, s2) > 0) {
+    int_glob = i + 7;
+    return 1;
+  }
+  return 0;
+}
+
+static enum kind proc_6(enum kind k) {
+  switch (k) {
+    case IDENT_1: return IDENT_1;
+    case IDENT_2: return int_glob > 100 ? IDENT_1 : IDENT_4;
+    case IDENT_3: return IDENT_2;
+    case IDENT_4: return IDENT_3;
+    default: return IDENT_5;
+  }
+}
+
+static void proc_8(int* a1, int (*a2)[50], int x, int y) {
+  int loc = x + 5;
+  a1[loc] = y;
+  a1[loc+1] = a1[loc];
+  a1[loc+30] = loc;
+  for (int i = loc; i <= loc+1; ++i) a2[loc][i] = loc;
+  a2[loc][loc-1] += 1;
+  a2[loc+20][loc] = a1[loc];
+  int_glob = 5;
+}
+
+static void proc_1(struct record* p) {
+  struct record* next = p->ptr;
+  *next = *p;
+  p->int_comp = 5;
+  next->int_comp = p->int_comp;
+  next->ptr = p->ptr;
+  if (next->discr == IDENT_1) {
+    next->int_comp = 6;
+    next->enum_comp = proc_6(p->enum_comp);
+    next->ptr = p->ptr;
+    next->int_comp = (next->int_comp + 10) % 17;
+  } else {
+    *p = *next;
+  }
+}
+
+/* CoreMark-style state machine over a string of digits and signs */
+static uint32_t scan(const char* s) {
+  uint32_t state = 0, transitions = 0;
+  for (; *s; ++s) {
+    uint32_t next;
+    switch (state) {
+      case 0: next = (*s == '+' || *s == '-') ? 1 : (*s >= '0' && *s <= '9') ? 2 : 4; break;
+      case 1: next = (*s >= '0' && *s <= '9') ? 2 : 4; break;
+      case 2: next = (*s == '.') ? 3 : (*s >= '0' && *s <= '9') ? 2 : 0; break;
+      case 3: next = (*s >= '0' && *s <= '9') ? 3 : 0; break;
+      default: next = (*s == ',') ? 0 : 4; break;
+    }
+    transitions += next != state;
+    state = next;
+  }
+  return transitions << 4 | state;
+}
+
+static uint16_t crc16(uint16_t crc, uint32_t v) {
+  for (int i = 0; i < 32; ++i) {
+    uint16_t bit = (crc ^ v) & 1;
+    crc >>= 1;
+    v >>= 1;
+    if (bit) crc ^= 0xa001;
+  }
+  return crc;
+}
+
+int bench_main(void) {
+  static const char* inputs[4] = { "+12.5,-3,x7,0.25", "99,12a.3,-.5,", "3.14159,2.71828", "--1,+,7.,." };
+  uint16_t crc = 0;
+  uint64_t sum = 0;
+
+  rec_a.ptr = &rec_b;
+  rec_a.discr = IDENT_1;
+  rec_a.enum_comp = IDENT_3;
+  rec_a.int_comp = 40;
+  str_copy(rec_a.str_comp, "DHRYSTONE PROGRAM, SOME STRING");
+  str_copy(str_1, "DHRYSTONE PROGRAM, 1'ST STRING");
+
+  for (int run = 1; run <= LOOPS; ++run) {
+    int int_1 = 2, int_2 = 3, int_3;
+    str_copy(str_2, "DHRYSTONE PROGRAM, 2'ND STRING");
+    int bool_glob = !func_2(str_1, str_2);
+    while (int_1 < int_2) {
+      int_3 = 5 * int_1 - int_2;
+      ++int_1;
+    }
+    proc_8(arr_1, arr_2, int_1, int_3);
+    rec_b.discr = IDENT_1;
+    proc_1(&rec_a);
+    for (char c = 'A'; c <= 'C'; ++c)
+      if (func_1(c, 'C') == IDENT_2) int_glob = run;
+    int_2 = int_2 * int_1;
+    int_1 = int_2 / int_3;
+    int_2 = 7 * (int_2 - int_3) - int_1;
+    sum += (uint64_t)(int_1 + int_2 + int_3 + int_glob + bool_glob + rec_b.int_comp + rec_b.enum_comp);
+    crc = crc16(crc, scan(inputs[run % 4]) + run);
+  }
+  check("dhry", sum, 0x1fb918);
+  check("arrays", (uint64_t)(arr_1[8] + arr_2[8][7] + arr_2[28][8]), 0x7de);
+  check("crc", crc, 0xdb06);
+  return bench_finish("dhry");
+}
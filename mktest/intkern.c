@@ -0,0 +1,67 @@
+/* Integer kernels: matrix multiply, CRC-32, sieve of Eratosthenes and gcd. */
+#include "bench.h"
+
+#define N 16
+#define SIEVE 8192
+
+static int64_t a[N][N], b[N][N], c[N][N];
+static unsigned char composite[SIEVE];
+static unsigned char msg[1024];
+
+static uint64_t matmul(void) {
+  uint64_t sum = 0;
+  for (int i = 0; i < N; ++i)
+    for (int j = 0; j < N; ++j) {
+      a[i][j] = (int64_t)(lcg() % 201) - 100;
+      b[i][j] = (int64_t)(lcg() % 201) - 100;
+    }
+  for (int i = 0; i < N; ++i)
+    for (int j = 0; j < N; ++j) {
+      int64_t s = 0;
+      for (int k = 0; k < N; ++k) s += a[i][k] * b[k][j];
+      c[i][j] = s;
+    }
+  for (int i = 0; i < N; ++i)
+    for (int j = 0; j < N; ++j) sum = sum * 31 + (uint64_t)c[i][j];
+  return sum;
+}
+
+static uint32_t crc32(const unsigned char* p, int n) {
+  uint32_t crc = 0xffffffffu;
+  while (n--) {
+    crc ^= *p++;
+    for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static uint64_t sieve(void) {
+  uint64_t count = 0, sum = 0;
+  for (int i = 2; i < SIEVE; ++i) {
+    if (composite[i]) continue;
+    ++count;
+    sum += i;
+    for (int j = 2*i; j < SIEVE; j += i) composite[j] = 1;
+  }
+  return count << 32 | sum;
+}
+
+static uint64_t gcd(uint64_t x, uint64_t y) {
+  while (y) {
+    uint64_t t = x % y;
+    x = y;
+    y = t;
+  }
+  return x;
+}
+
+int bench_main(void) {
+  check("matmul", matmul(), 0xe133da75897ea7f0ull);
+  for (int i = 0; i < (int)sizeof(msg); ++i) msg[i] = (unsigned char)lcg();
+  check("crc32", crc32(msg, sizeof(msg)), 0xb99fc100);
+  check("sieve", sieve(), 0x00000404003ba421ull);
+  uint64_t g = 0;
+  for (int i = 1; i <= 200; ++i) g += gcd((uint64_t)lcg() * i, (uint64_t)lcg() * 6 * i);
+  check("gcd", g, 0x1b229);
+  return bench_finish("intkern");
+}
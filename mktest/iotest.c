@@ -0,0 +1,38 @@
+/* Syscall-heavy I/O: many small writes to a file, then reads them back and checks them. */
+#include "bench.h"
+
+#define RECORDS 256
+#define RECORD 64
+
+#define O_RDWR  02
+#define O_CREAT 0100
+#define O_TRUNC 01000
+
+static unsigned char record[RECORD], back[RECORD];
+
+static void fill(unsigned char* r, int n) {
+  for (int i = 0; i < RECORD; ++i) r[i] = (unsigned char)(n * 7 + i);
+}
+
+int bench_main(void) {
+  const char* path = "bench_io.tmp";
+  uint64_t written = 0, bad = 0;
+  long fd = bench_syscall(SYS_open, (long)path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  check("open", fd < 0, 0);
+  for (int n = 0; n < RECORDS; ++n) {
+    fill(record, n);
+    written += bench_syscall(SYS_write, fd, (long)record, RECORD);
+  }
+  check("written", written, RECORDS*RECORD);
+  bench_syscall(SYS_lseek, fd, 0, 0);
+  for (int n = 0; n < RECORDS; ++n) {
+    fill(record, n);
+    if (bench_syscall(SYS_read, fd, (long)back, RECORD) != RECORD) ++bad;
+    for (int i = 0; i < RECORD; ++i)
+      if (back[i] != record[i]) ++bad;
+  }
+  check("bad", bad, 0);
+  bench_syscall(SYS_close, fd, 0, 0);
+  bench_syscall(SYS_unlink, (long)path, 0, 0);
+  return bench_finish("iotest");
+}
@@ -0,0 +1,46 @@
+/* memcpy/memset streams over buffers larger than the L1 caches. */
+#include "bench.h"
+
+#define WORDS 8192 /* 64KB per buffer */
+#define PASSES 4
+
+static uint64_t src[WORDS], dst[WORDS];
+
+static void copy_words(uint64_t* d, const uint64_t* s, int n) {
+  for (int i = 0; i < n; i += 4) {
+    d[i] = s[i];
+    d[i+1] = s[i+1];
+    d[i+2] = s[i+2];
+    d[i+3] = s[i+3];
+  }
+}
+
+static void set_words(uint64_t* d, uint64_t v, int n) {
+  for (int i = 0; i < n; ++i) d[i] = v;
+}
+
+static void copy_bytes(unsigned char* d, const unsigned char* s, int n) {
+  for (int i = 0; i < n; ++i) d[i] = s[i];
+}
+
+static uint64_t sum_words(const uint64_t* s, int n) {
+  uint64_t sum = 0;
+  for (int i = 0; i < n; ++i) sum = (sum ^ s[i]) * 0x100000001b3ull;
+  return sum;
+}
+
+int bench_main(void) {
+  uint64_t sum = 0;
+  for (int i = 0; i < WORDS; ++i) src[i] = (uint64_t)lcg() << 32 | lcg();
+  for (int p = 0; p < PASSES; ++p) {
+    set_words(dst, 0x0101010101010101ull * p, WORDS);
+    sum += sum_words(dst, WORDS);
+    copy_words(dst, src, WORDS);
+    sum += sum_words(dst, WORDS);
+    src[p] ^= sum;
+  }
+  check("words", sum, 0xa5cbdc36a7e5eb80ull);
+  copy_bytes((unsigned char*)dst + 3, (unsigned char*)src, WORDS*8 - 8);
+  check("bytes", sum_words(dst, WORDS), 0xbd1e3d51d7f8f568ull);
+  return bench_finish("memstream");
+}
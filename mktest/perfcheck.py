@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""Runs the benchmarks on the simulator and compares their cycle counts with baseline.txt.
+
+Fails when a benchmark doesn't print PASS, or takes more than --threshold percent
+more cycles than its baseline, or has no baseline (unless --allow-missing is given,
+then it only gets a warning with the cycles to record). --record writes the measured
+cycles as the new baseline.
+The tests in ASYNC_TESTS run with ASYNC_ECALL=1 and fail unless simulated cycles
+went on while their system calls were running on the host.
+
+    ./perfcheck.py --sim ../obj_dir/Vtop
+    ./perfcheck.py --sim ../obj_dir/Vtop --record
+"""
+
+import argparse
+import concurrent.futures
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+BENCHMARKS = ["intkern", "dhry", "memstream", "ptrchase", "sort", "iotest", "atomic"]
+BENCHMARKS += [name + "-c" for name in BENCHMARKS]  # built with compressed instructions
+ASYNC_TESTS = ["sleep"]
+
+
+def read_baseline(path):
+    baseline = {}
+    if os.path.exists(path):
+        with open(path) as f:
+            for line in f:
+                line = line.split("#")[0].split()
+                if len(line) == 2:
+                    baseline[line[0]] = int(line[1])
+    return baseline
+
+
+def write_baseline(path, cycles):
+    with open(path, "w") as f:
+        f.write("# simulated cycles of each benchmark, written by perfcheck.py --record\n")
+        for name in sorted(cycles):
+            f.write("%s %d\n" % (name, cycles[name]))
+
+
+def run(sim, name, timeout, extra_env={}):
+    with tempfile.TemporaryDirectory() as rundir:
+        env = dict(os.environ)
+        env["DRAMSIM_DIR"] = os.path.join(HERE, "..", "dramsim2")
+        env["DRAM_RESULT"] = "perfcheck-" + name
+        env.update(extra_env)
+        try:
+            p = subprocess.run([sim, os.path.join(HERE, name)], cwd=rundir, env=env, timeout=timeout,
+                               stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+            text = p.stdout.decode(errors="replace")
+        except subprocess.TimeoutExpired:
+            return None, "timeout", ""
+    m = re.search(r"Simulation: (\d+) cycles", text)
+    if not m:
+        return None, "no cycle count", text
+    if not re.search(r"^%s: PASS$" % re.sub(r"-c$", "", name), text, re.M):
+        failed = [l for l in text.splitlines() if "FAIL" in l]
+        return int(m.group(1)), "; ".join(failed) or "no PASS line", text
+    return int(m.group(1)), None, text
+
+
+def run_async(sim, name, timeout):
+    """Returns the cycles the core stalled for calls on the I/O thread, and an error."""
+    cycles, error, text = run(sim, name, timeout, {"ASYNC_ECALL": "1"})
+    if error:
+        return None, error
+    m = re.search(r"Async ecalls: (\d+) calls on the I/O thread, \S+ s host time, (\d+) cycles stalled", text)
+    if not m or int(m.group(1)) == 0:
+        return None, "no calls on the I/O thread"
+    if int(m.group(2)) == 0:
+        return 0, "no cycles went by while the calls were on the host"
+    return int(m.group(2)), None
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--sim", default=os.path.join(HERE, "..", "obj_dir", "Vtop"))
+    ap.add_argument("--baseline", default=os.path.join(HERE, "baseline.txt"))
+    ap.add_argument("--threshold", type=float, default=2.0, help="allowed slowdown in percent")
+    ap.add_argument("--timeout", type=int, default=3600, help="seconds per benchmark")
+    ap.add_argument("--record", action="store_true", help="write the measured cycles to the baseline")
+    ap.add_argument("--allow-missing", action="store_true", help="only warn about benchmarks without a baseline")
+    ap.add_argument("benchmarks", nargs="*", default=BENCHMARKS)
+    args = ap.parse_args()
+
+    sim = os.path.abspath(args.sim)
+    baseline = read_baseline(args.baseline)
+    with concurrent.futures.ThreadPoolExecutor() as pool:
+        results = dict(zip(args.benchmarks, pool.map(lambda b: run(sim, b, args.timeout), args.benchmarks)))
+        async_results = dict(zip(ASYNC_TESTS, pool.map(lambda b: run_async(sim, b, args.timeout), ASYNC_TESTS)))
+
+    failed = 0
+    for name in args.benchmarks:
+        cycles, error, _ = results[name]
+        if error:
+            print("%-10s FAIL %s" % (name, error))
+            failed += 1
+        elif args.record:
+            print("%-10s %d cycles" % (name, cycles))
+        elif name not in baseline:
+            print("%-10s %s %d cycles, no baseline (record it with make perfbaseline)" % (name,
+                  "warn" if args.allow_missing else "FAIL", cycles))
+            failed += not args.allow_missing
+        else:
+            change = 100.0 * (cycles - baseline[name]) / baseline[name]
+            regressed = change > args.threshold
+            print("%-10s %s %d cycles, baseline %d (%+.2f%%)" % (name, "FAIL" if regressed else "ok  ",
+                  cycles, baseline[name], change))
+            failed += regressed
+
+    for name in ASYNC_TESTS:
+        stalled, error = async_results[name]
+        if error:
+            print("%-10s FAIL async: %s" % (name, error))
+            failed += 1
+        else:
+            print("%-10s ok   async: %d cycles stalled" % (name, stalled))
+
+    if args.record and not failed:
+        baseline.update((name, results[name][0]) for name in args.benchmarks)
+        write_baseline(args.baseline, baseline)
+        print("baseline written to %s" % args.baseline)
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
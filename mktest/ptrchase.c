@@ -0,0 +1,39 @@
+/* Linked-list pointer chase: nodes are linked in a random order, so every step is a dependent miss. */
+#include "bench.h"
+
+#define NODES 4096 /* one node per cache line, 256KB */
+#define WALKS 8
+
+struct node {
+  struct node* next;
+  uint64_t value;
+  uint64_t pad[6];
+};
+
+static struct node nodes[NODES];
+static uint32_t order[NODES];
+
+int bench_main(void) {
+  for (int i = 0; i < NODES; ++i) order[i] = i;
+  for (int i = NODES-1; i > 0; --i) {
+    uint32_t j = lcg() % (i+1);
+    uint32_t t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+  for (int i = 0; i < NODES; ++i) {
+    nodes[order[i]].next = &nodes[order[(i+1) % NODES]];
+    nodes[order[i]].value = lcg();
+  }
+
+  uint64_t sum = 0;
+  struct node* p = &nodes[order[0]];
+  for (int w = 0; w < WALKS; ++w)
+    for (int i = 0; i < NODES; ++i) {
+      sum = sum * 3 + p->value;
+      p = p->next;
+    }
+  check("chase", sum, 0x0cbd69f87802b280ull);
+  check("end", (uint64_t)(p - nodes), 0x1bf);
+  return bench_finish("ptrchase");
+}
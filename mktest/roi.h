@@ -0,0 +1,17 @@
+/* Region of interest markers. With PROFILE=<cycles> set when running Vtop,
+   only the code between ROI_BEGIN() and ROI_END() is profiled. */
+#ifndef ROI_H
+#define ROI_H
+
+#define ECALL_ROI 1500 /* same number as in system.h */
+
+static inline void roi_mark(long start) {
+  register long a0 asm("a0") = start;
+  register long a7 asm("a7") = ECALL_ROI;
+  asm volatile("ecall" : "+r"(a0) : "r"(a7) : "memory");
+}
+
+#define ROI_BEGIN() roi_mark(1)
+#define ROI_END()   roi_mark(0)
+
+#endif
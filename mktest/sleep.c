@@ -0,0 +1,15 @@
+/* A blocking sleep. perfcheck.py runs it with ASYNC_ECALL=1 and checks that simulated
+   cycles went on while the sleep was outstanding on the host. */
+#include "bench.h"
+
+#define SLEEPS 4
+
+static struct { long sec, nsec; } req = { 0, 20000000 }; /* 20 ms */
+
+int bench_main(void) {
+  uint64_t bad = 0;
+  for (int n = 0; n < SLEEPS; ++n)
+    if (bench_syscall(SYS_nanosleep, (long)&req, 0, 0) != 0) ++bad;
+  check("bad", bad, 0);
+  return bench_finish("sleep");
+}
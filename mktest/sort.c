@@ -0,0 +1,60 @@
+/* Branchy sort: quicksort with an insertion sort cutoff on random keys. */
+#include "bench.h"
+
+#define KEYS 8192
+
+static uint32_t keys[KEYS];
+
+static void insertion_sort(uint32_t* v, int n) {
+  for (int i = 1; i < n; ++i) {
+    uint32_t k = v[i];
+    int j = i - 1;
+    while (j >= 0 && v[j] > k) {
+      v[j+1] = v[j];
+      --j;
+    }
+    v[j+1] = k;
+  }
+}
+
+static void quicksort(uint32_t* v, int n) {
+  while (n > 16) {
+    uint32_t pivot = v[n/2];
+    int i = 0, j = n - 1;
+    while (i <= j) {
+      while (v[i] < pivot) ++i;
+      while (v[j] > pivot) --j;
+      if (i <= j) {
+        uint32_t t = v[i];
+        v[i] = v[j];
+        v[j] = t;
+        ++i;
+        --j;
+      }
+    }
+    /* recurse on the smaller half to bound the stack */
+    if (j + 1 < n - i) {
+      quicksort(v, j + 1);
+      v += i;
+      n -= i;
+    } else {
+      quicksort(v + i, n - i);
+      n = j + 1;
+    }
+  }
+  insertion_sort(v, n);
+}
+
+int bench_main(void) {
+  uint64_t sum = 0;
+  for (int i = 0; i < KEYS; ++i) keys[i] = lcg() % 100000;
+  quicksort(keys, KEYS);
+  uint64_t unsorted = 0;
+  for (int i = 0; i < KEYS; ++i) {
+    if (i && keys[i-1] > keys[i]) ++unsorted;
+    sum = sum * 7 + keys[i];
+  }
+  check("unsorted", unsorted, 0);
+  check("keys", sum, 0xa10644fa05a4655cull);
+  return bench_finish("sort");
+}
@@ -0,0 +1,112 @@
+module rvc_expander
+	(
+	  // 16-bit compressed instruction (RV64C)
+	  input [15:0] in,
+
+	  // the 32-bit instruction it stands for, 0 if it is illegal or not supported (F/D)
+	  output [31:0] out
+	);
+
+	logic [4:0] rd;		//rd/rs1 field of the CR/CI formats
+	logic [4:0] rs2;	//rs2 field of the CR/CSS formats
+	logic [4:0] rdp;	//rd'/rs1' (x8-x15)
+	logic [4:0] rs2p;	//rd'/rs2' (x8-x15)
+	logic [11:0] ci_imm;	//sign extended 6-bit immediate of C.ADDI, C.LI, C.ANDI...
+	logic [5:0] shamt;
+	logic [11:0] addi4spn_imm;
+	logic [11:0] addi16sp_imm;
+	logic [11:0] lw_imm;	//C.LW/C.SW
+	logic [11:0] ld_imm;	//C.LD/C.SD
+	logic [11:0] lwsp_imm;
+	logic [11:0] ldsp_imm;
+	logic [11:0] swsp_imm;
+	logic [11:0] sdsp_imm;
+	logic [20:0] j_imm;
+	logic [12:0] b_imm;
+
+	always_comb begin
+		rd = in[11:7];
+		rs2 = in[6:2];
+		rdp = {2'b01, in[9:7]};
+		rs2p = {2'b01, in[4:2]};
+		ci_imm = {{7{in[12]}}, in[6:2]};
+		shamt = {in[12], in[6:2]};
+		addi4spn_imm = {2'b0, in[10:7], in[12:11], in[5], in[6], 2'b0};
+		addi16sp_imm = {{3{in[12]}}, in[4:3], in[5], in[2], in[6], 4'b0};
+		lw_imm = {5'b0, in[5], in[12:10], in[6], 2'b0};
+		ld_imm = {4'b0, in[6:5], in[12:10], 3'b0};
+		lwsp_imm = {4'b0, in[3:2], in[12], in[6:4], 2'b0};
+		ldsp_imm = {3'b0, in[4:2], in[12], in[6:5], 3'b0};
+		swsp_imm = {4'b0, in[8:7], in[12:9], 2'b0};
+		sdsp_imm = {3'b0, in[9:7], in[12:10], 3'b0};
+		j_imm = {{10{in[12]}}, in[8], in[10:9], in[6], in[7], in[2], in[11], in[5:3], 1'b0};
+		b_imm = {{5{in[12]}}, in[6:5], in[2], in[11:10], in[4:3], 1'b0};
+
+		out = 0;
+		case({in[15:13], in[1:0]})
+			// Quadrant 0
+			5'b000_00: if(addi4spn_imm != 0) out = {addi4spn_imm, 5'd2, 3'b000, rs2p, 7'b0010011};	//C.ADDI4SPN: addi rd', x2, imm
+			5'b010_00: out = {lw_imm, rdp, 3'b010, rs2p, 7'b0000011};					//C.LW: lw rd', imm(rs1')
+			5'b011_00: out = {ld_imm, rdp, 3'b011, rs2p, 7'b0000011};					//C.LD: ld rd', imm(rs1')
+			5'b110_00: out = {lw_imm[11:5], rs2p, rdp, 3'b010, lw_imm[4:0], 7'b0100011};		//C.SW: sw rs2', imm(rs1')
+			5'b111_00: out = {ld_imm[11:5], rs2p, rdp, 3'b011, ld_imm[4:0], 7'b0100011};		//C.SD: sd rs2', imm(rs1')
+
+			// Quadrant 1
+			5'b000_01: out = {ci_imm, rd, 3'b000, rd, 7'b0010011};					//C.ADDI (C.NOP): addi rd, rd, imm
+			5'b001_01: if(rd != 0) out = {ci_imm, rd, 3'b000, rd, 7'b0011011};			//C.ADDIW: addiw rd, rd, imm
+			5'b010_01: out = {ci_imm, 5'd0, 3'b000, rd, 7'b0010011};				//C.LI: addi rd, x0, imm
+			5'b011_01: begin
+					if(rd == 2) begin
+						if(addi16sp_imm != 0) out = {addi16sp_imm, 5'd2, 3'b000, 5'd2, 7'b0010011};	//C.ADDI16SP: addi x2, x2, imm
+					end
+					else if(ci_imm != 0) begin
+						out = {{8{in[12]}}, ci_imm, rd, 7'b0110111};					//C.LUI: lui rd, imm
+					end
+				end
+			5'b100_01: begin
+					case(in[11:10])
+						2'b00: out = {6'b000000, shamt, rdp, 3'b101, rdp, 7'b0010011};		//C.SRLI
+						2'b01: out = {6'b010000, shamt, rdp, 3'b101, rdp, 7'b0010011};		//C.SRAI
+						2'b10: out = {ci_imm, rdp, 3'b111, rdp, 7'b0010011};			//C.ANDI
+						2'b11: begin
+								case({in[12], in[6:5]})
+									3'b000: out = {7'b0100000, rs2p, rdp, 3'b000, rdp, 7'b0110011};	//C.SUB
+									3'b001: out = {7'b0000000, rs2p, rdp, 3'b100, rdp, 7'b0110011};	//C.XOR
+									3'b010: out = {7'b0000000, rs2p, rdp, 3'b110, rdp, 7'b0110011};	//C.OR
+									3'b011: out = {7'b0000000, rs2p, rdp, 3'b111, rdp, 7'b0110011};	//C.AND
+									3'b100: out = {7'b0100000, rs2p, rdp, 3'b000, rdp, 7'b0111011};	//C.SUBW
+									3'b101: out = {7'b0000000, rs2p, rdp, 3'b000, rdp, 7'b0111011};	//C.ADDW
+									default: out = 0;
+								endcase
+							end
+					endcase
+				end
+			5'b101_01: out = {j_imm[20], j_imm[10:1], j_imm[11], j_imm[19:12], 5'd0, 7'b1101111};	//C.J: jal x0, imm
+			5'b110_01: out = {b_imm[12], b_imm[10:5], 5'd0, rdp, 3'b000, b_imm[4:1], b_imm[11], 7'b1100011};	//C.BEQZ: beq rs1', x0, imm
+			5'b111_01: out = {b_imm[12], b_imm[10:5], 5'd0, rdp, 3'b001, b_imm[4:1], b_imm[11], 7'b1100011};	//C.BNEZ: bne rs1', x0, imm
+
+			// Quadrant 2
+			5'b000_10: out = {6'b000000, shamt, rd, 3'b001, rd, 7'b0010011};				//C.SLLI
+			5'b010_10: if(rd != 0) out = {lwsp_imm, 5'd2, 3'b010, rd, 7'b0000011};		//C.LWSP: lw rd, imm(x2)
+			5'b011_10: if(rd != 0) out = {ldsp_imm, 5'd2, 3'b011, rd, 7'b0000011};		//C.LDSP: ld rd, imm(x2)
+			5'b100_10: begin
+					if(in[12] == 0) begin
+						if(rs2 == 0) begin
+							if(rd != 0) out = {12'b0, rd, 3'b000, 5'd0, 7'b1100111};		//C.JR: jalr x0, 0(rs1)
+						end
+						else out = {7'b0000000, rs2, 5'd0, 3'b000, rd, 7'b0110011};		//C.MV: add rd, x0, rs2
+					end
+					else begin
+						if(rs2 == 0 && rd == 0) out = 32'h00100073;					//C.EBREAK
+						else if(rs2 == 0) out = {12'b0, rd, 3'b000, 5'd1, 7'b1100111};		//C.JALR: jalr x1, 0(rs1)
+						else out = {7'b0000000, rs2, rd, 3'b000, rd, 7'b0110011};			//C.ADD: add rd, rd, rs2
+					end
+				end
+			5'b110_10: out = {swsp_imm[11:5], rs2, 5'd2, 3'b010, swsp_imm[4:0], 7'b0100011};	//C.SWSP: sw rs2, imm(x2)
+			5'b111_10: out = {sdsp_imm[11:5], rs2, 5'd2, 3'b011, sdsp_imm[4:0], 7'b0100011};	//C.SDSP: sd rs2, imm(x2)
+
+			default: out = 0;
+		endcase
+	end
+
+endmodule
@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+"""Design-space sweep.
+
+Builds one simulator per distinct set of top.sv parameters (cached under
+sweep/build/<hash of the sources and parameters>), runs every workload on
+every point of the grid in parallel, and stores cycles, IPC, miss rates and
+energy in sweep/results.csv and sweep/results.db (table "runs").
+
+    ./sweep.py                                  # default grid, test_cases/*.o
+    ./sweep.py -w test_cases/sum.o -j 8
+    ./sweep.py --grid L1_LINES=32,64 --grid PS_PER_CLOCK=500,250
+    sqlite3 sweep/results.db "select * from runs order by cycles"
+"""
+
+import argparse
+import concurrent.futures
+import csv
+import glob
+import hashlib
+import itertools
+import os
+import re
+import sqlite3
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+OUT = os.path.join(ROOT, "sweep")
+
+# top.sv parameters: a change needs its own verilator build
+RTL_PARAMS = ["L1_LINES", "L1_TYPE", "IF_PREFETCH", "MEM_PREFETCH",
+              "L2_ENABLE", "L2_SETS", "L2_WAYS", "EARLY_RESTART", "ARB_POLICY", "BUS_WIDTH",
+              "STORE_BUFFER", "FETCH_AHEAD"]
+# RTL parameters that are make variables, because the C++ side needs them too
+MAKE_PARAMS = ["BUS_WIDTH"]
+# read by the simulator at run time (see main.cpp and system.cpp)
+RUN_PARAMS = ["DRAM_INI", "PS_PER_CLOCK", "HAVETLB", "ASYNC_ECALL"]
+
+GRID = {
+    "L1_LINES": [16, 32, 64],
+    "L1_TYPE": [0, 1],
+    "L2_ENABLE": [0, 1],
+    "L2_WAYS": [4],
+    "DRAM_INI": ["DDR2_micron_16M_8b_x8_sg3E.ini"],
+    "PS_PER_CLOCK": [500],
+}
+
+FIELDS = RTL_PARAMS + RUN_PARAMS + [
+    "workload", "status", "cycles", "instructions", "ipc",
+    "icache_accesses", "icache_misses", "icache_miss_rate",
+    "dcache_accesses", "dcache_misses", "dcache_miss_rate",
+    "l2_hits", "l2_misses", "l2_miss_rate", "energy_nj", "core_nj", "dram_nj", "edp", "seconds", "build",
+]
+
+
+def parse_grid(args):
+    grid = dict(GRID)
+    for arg in args or []:
+        name, _, values = arg.partition("=")
+        if name not in RTL_PARAMS + RUN_PARAMS:
+            sys.exit("unknown parameter %s (known: %s)" % (name, " ".join(RTL_PARAMS + RUN_PARAMS)))
+        grid[name] = values.split(",")
+    names = sorted(grid)
+    return [dict(zip(names, values)) for values in itertools.product(*(grid[n] for n in names))]
+
+
+def source_hash(rtl):
+    h = hashlib.sha1()
+    for path in sorted(glob.glob(os.path.join(ROOT, "*.sv")) + glob.glob(os.path.join(ROOT, "*.cpp")) +
+                       glob.glob(os.path.join(ROOT, "*.h")) + glob.glob(os.path.join(ROOT, "*.defs")) +
+                       [os.path.join(ROOT, "Makefile")]):
+        h.update(os.path.basename(path).encode())
+        with open(path, "rb") as f:
+            h.update(f.read())
+    h.update(repr(sorted(rtl.items())).encode())
+    return h.hexdigest()[:16]
+
+
+def build(rtl):
+    """Build (or reuse) the simulator for one set of RTL parameters."""
+    key = source_hash(rtl)
+    objdir = os.path.join(OUT, "build", key)
+    vtop = os.path.join(objdir, "Vtop")
+    if os.path.exists(vtop):
+        return key, vtop
+    vparams = " ".join("-G%s=%s" % (k, v) for k, v in sorted(rtl.items()) if k not in MAKE_PARAMS)
+    makevars = ["%s=%s" % (k, v) for k, v in sorted(rtl.items()) if k in MAKE_PARAMS]
+    log = os.path.join(OUT, "build", key + ".log")
+    os.makedirs(os.path.dirname(log), exist_ok=True)
+    with open(log, "w") as f:
+        rc = subprocess.call(["make", "-C", ROOT, "OBJDIR=" + objdir, "VPARAMS=" + vparams, "TRACE="] + makevars,
+                             stdout=f, stderr=subprocess.STDOUT)
+    if rc != 0 or not os.path.exists(vtop):
+        sys.exit("build of %s failed, see %s" % (" ".join([vparams] + makevars).strip() or "defaults", log))
+    return key, vtop
+
+
+def parse_output(text):
+    r = {}
+    m = re.search(r"Simulation: (\d+) cycles, (\d+) instructions", text)
+    if m:
+        r["cycles"], r["instructions"] = int(m.group(1)), int(m.group(2))
+        r["ipc"] = r["instructions"] / r["cycles"] if r["cycles"] else 0
+    for cache, name in (("icache", "IF_cache_mod"), ("dcache", "MEM_cache_mod")):
+        m = re.search(name + r": (\d+) demand accesses, (\d+) misses", text)
+        if m:
+            r[cache + "_accesses"], r[cache + "_misses"] = int(m.group(1)), int(m.group(2))
+            r[cache + "_miss_rate"] = r[cache + "_misses"] / r[cache + "_accesses"] if r[cache + "_accesses"] else 0
+    m = re.search(r"L2: (\d+) read hits, (\d+) read misses", text)
+    if m:
+        r["l2_hits"], r["l2_misses"] = int(m.group(1)), int(m.group(2))
+        total = r["l2_hits"] + r["l2_misses"]
+        r["l2_miss_rate"] = r["l2_misses"] / total if total else 0
+    m = re.search(r"Energy \(run\): ([\d.]+) nJ total \(([\d.]+) core, ([\d.]+) DRAM\), [\d.]+ mW average, (\S+) J\*s EDP", text)
+    if m:
+        r["energy_nj"], r["core_nj"], r["dram_nj"], r["edp"] = (float(g) for g in m.groups())
+    return r
+
+
+def run(point, key, vtop, workload, timeout):
+    name = os.path.basename(workload)
+    run_id = "%s-%s-%s" % (key, hashlib.sha1(repr(sorted(point.items())).encode()).hexdigest()[:8], name)
+    rundir = os.path.join(OUT, "runs", run_id)
+    os.makedirs(rundir, exist_ok=True)
+    env = dict(os.environ)
+    env["DRAMSIM_DIR"] = os.path.join(ROOT, "dramsim2")
+    env["DRAM_RESULT"] = run_id  # keep parallel runs out of each other's result files
+    env["ENERGY"] = "1"
+    for k in RUN_PARAMS:
+        if k in point:
+            env[k] = str(point[k])
+    row = dict(point, workload=name, build=key)
+    start = time.time()
+    try:
+        p = subprocess.run([vtop, os.path.abspath(workload)], cwd=rundir, env=env, timeout=timeout,
+                           stdin=subprocess.DEVNULL, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        text = p.stdout.decode(errors="replace")
+        row["status"] = "ok" if p.returncode == 0 else "exit %d" % p.returncode
+    except subprocess.TimeoutExpired as e:
+        text = (e.stdout or b"").decode(errors="replace")
+        row["status"] = "timeout"
+    row["seconds"] = round(time.time() - start, 2)
+    with open(os.path.join(rundir, "output.txt"), "w") as f:
+        f.write(text)
+    row.update(parse_output(text))
+    return row
+
+
+def save(rows, csv_path, db_path):
+    new = not os.path.exists(csv_path)
+    with open(csv_path, "a", newline="") as f:
+        w = csv.DictWriter(f, fieldnames=FIELDS)
+        if new:
+            w.writeheader()
+        for row in rows:
+            w.writerow(row)
+    db = sqlite3.connect(db_path)
+    db.execute("create table if not exists runs (%s, time text)" % ", ".join(FIELDS))
+    columns = [c[1] for c in db.execute("pragma table_info(runs)")]
+    for k in FIELDS:  # results.db from before a field was added
+        if k not in columns:
+            db.execute("alter table runs add column %s" % k)
+    db.executemany("insert into runs (%s, time) values (%s, datetime('now'))" % (", ".join(FIELDS), ", ".join("?" * len(FIELDS))),
+                   [[row.get(k) for k in FIELDS] for row in rows])
+    db.commit()
+    db.close()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("-w", "--workloads", nargs="+", default=sorted(glob.glob(os.path.join(ROOT, "test_cases", "*.o"))))
+    ap.add_argument("-g", "--grid", action="append", metavar="NAME=V1,V2", help="replace the values of one parameter")
+    ap.add_argument("-j", "--jobs", type=int, default=os.cpu_count())
+    ap.add_argument("--timeout", type=int, default=3600, help="seconds per run")
+    ap.add_argument("--csv", default=os.path.join(OUT, "results.csv"))
+    ap.add_argument("--db", default=os.path.join(OUT, "results.db"))
+    args = ap.parse_args()
+
+    points = parse_grid(args.grid)
+    os.makedirs(OUT, exist_ok=True)
+
+    # builds run one at a time (each make already uses several jobs)
+    builds = {}
+    for point in points:
+        rtl = {k: point[k] for k in RTL_PARAMS if k in point}
+        key = repr(sorted(rtl.items()))
+        if key not in builds:
+            builds[key] = build(rtl)
+            print("built %s: %s" % (builds[key][0], rtl or "defaults"), flush=True)
+
+    rows = []
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+        futures = []
+        for point in points:
+            key, vtop = builds[repr(sorted((k, point[k]) for k in RTL_PARAMS if k in point))]
+            for workload in args.workloads:
+                futures.append(pool.submit(run, point, key, vtop, workload, args.timeout))
+        for f in concurrent.futures.as_completed(futures):
+            row = f.result()
+            rows.append(row)
+            print("%-24s %-8s cycles %-10s IPC %.3f  %s" % (row["workload"], row["status"], row.get("cycles", "-"),
+                  row.get("ipc", 0), {k: row[k] for k in sorted(row) if k in RTL_PARAMS + RUN_PARAMS}), flush=True)
+
+    save(rows, args.csv, args.db)
+    print("%d runs saved to %s and %s" % (len(rows), args.csv, args.db))
+
+
+if __name__ == "__main__":
+    main()
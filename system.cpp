@@ -12,6 +12,11 @@
 #include <arpa/inet.h>
 #include <ncurses.h>
 #include <set>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <poll.h>
 #include "system.h"
 #include "Vtop.h"
 
@@ -29,16 +34,67 @@ enum {
     IRQ    = 0b1110
 };
 
+// Verilator makes bus ports wider than 64 bits arrays of 32-bit words
+#if BUS_WIDTH > 64
+template<class T> static uint64_t bus_word(const T& port, int i) {
+    return port[2*i] | ((uint64_t)port[2*i+1] << 32);
+}
+template<class T> static void set_bus_word(T& port, int i, uint64_t v) {
+    port[2*i] = (uint32_t)v;
+    port[2*i+1] = (uint32_t)(v >> 32);
+}
+#else
+template<class T> static uint64_t bus_word(const T& port, int i) { return port; }
+template<class T> static void set_bus_word(T& port, int i, uint64_t v) { port = v; }
+#endif
+
 System* System::sys;
 
+// Energy of each event in pJ: rough figures for a small in-order core in a 45nm process.
+// The bus beat is per 64 bits moved through the arbiter, and is scaled by the bus width.
+static const char* event_names[] = {
+    "cycle", "instruction", "rf_read", "rf_write", "alu", "mul", "div",
+    "icache_access", "dcache_access", "icache_fill", "dcache_fill", "l2_access", "l2_fill", "bus_beat"
+};
+static const double default_event_pj[] = {
+    5.0, 3.0, 1.5, 2.0, 0.5, 6.0, 20.0,
+    10.0, 10.0, 40.0, 40.0, 50.0, 100.0, 2.0
+};
+
 System::System(Vtop* top, unsigned ramsize, const char* ramelf, const int argc, char* argv[], int ps_per_clock)
-    : top(top), ps_per_clock(ps_per_clock), ramsize(ramsize), max_elf_addr(0), show_console(false), interrupts(0), rx_count(0), ticks(0), ecall_brk(0), errno_addr(NULL)
+    : top(top), ps_per_clock(ps_per_clock), ramsize(ramsize), max_elf_addr(0), show_console(false), interrupts(0), rx_count(0), ticks(0), instructions(0), ecall_brk(0), errno_addr(NULL)
 {
     sys = this;
 
     char* HAVETLB = getenv("HAVETLB");
     use_virtual_memory = HAVETLB && (toupper(*HAVETLB) == 'Y');
 
+    const char* PROFILE = getenv("PROFILE");
+    profile_period = PROFILE?atoi(PROFILE):0;
+    profile_cycles = 0;
+    last_commit_pc = 0;
+    roi_active = true; // the whole run, unless the program marks a region of interest
+    roi_seen = false;
+    func_profiles.assign(1, func_profile());
+
+    const char* ENERGY = getenv("ENERGY");
+    const char* ENERGY_TABLE = getenv("ENERGY_TABLE");
+    energy_on = (ENERGY && atoi(ENERGY)) || ENERGY_TABLE;
+    copy(default_event_pj, default_event_pj+NUM_EVENTS, event_pj);
+    if (ENERGY_TABLE) load_energy_table(ENERGY_TABLE);
+    memset(events, 0, sizeof(events));
+    memset(dram_energy, 0, sizeof(dram_energy));
+    dram_epoch_start = dram_epoch_end = 0;
+
+    for(int i = 0; i < CONSOLE_ROWS*CONSOLE_COLS; ++i) {
+        screen[i] = 0;
+        drawn[i] = 0;
+    }
+    dirty_rows = 0;
+    key_head = 0;
+    key_tail = 0;
+    console_running = false;
+
     string ram_fn = string("/vtop-system-")+to_string(getpid());
     ram_fd = shm_open(ram_fn.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
     assert(ram_fd != -1);
@@ -75,18 +131,28 @@ System::System(Vtop* top, unsigned ramsize, const char* ramelf, const int argc,
     ecall_brk = max_elf_addr;
 
     // create the dram simulator
-    dramsim = DRAMSim::getMemorySystemInstance("DDR2_micron_16M_8b_x8_sg3E.ini", "system.ini", "../dramsim2", "dram_result", ramsize / MEGA);
+    const char* DRAM_INI = getenv("DRAM_INI");
+    const char* DRAMSIM_DIR = getenv("DRAMSIM_DIR");
+    const char* DRAM_RESULT = getenv("DRAM_RESULT");
+    dramsim = DRAMSim::getMemorySystemInstance(DRAM_INI?DRAM_INI:"DDR2_micron_16M_8b_x8_sg3E.ini", "system.ini", DRAMSIM_DIR?DRAMSIM_DIR:"../dramsim2", DRAM_RESULT?DRAM_RESULT:"dram_result", ramsize / MEGA);
     DRAMSim::TransactionCompleteCB *read_cb = new DRAMSim::Callback<System, void, unsigned, uint64_t, uint64_t>(this, &System::dram_read_complete);
     DRAMSim::TransactionCompleteCB *write_cb = new DRAMSim::Callback<System, void, unsigned, uint64_t, uint64_t>(this, &System::dram_write_complete);
-    dramsim->RegisterCallbacks(read_cb, NULL, NULL);
+    dramsim->RegisterCallbacks(read_cb, NULL, energy_on ? dram_power : NULL);
     dramsim->setCPUClockSpeed(1000ULL*1000*1000*1000/ps_per_clock);
 }
 
 System::~System() {
+    if (profile_period) profile_report();
+    if (energy_on) energy_report();
+
     assert(munmap(ram, ramsize) == 0);
     assert(close(ram_fd) == 0);
 
     if (show_console) {
+        console_running = false;
+        render_thread.join();
+        keyboard_thread.join();
+        render_frame(); // whatever was written after the last frame
         sleep(2);
         endwin();
     }
@@ -100,6 +166,49 @@ void System::console() {
         noecho();
         cbreak();
         timeout(0);
+        console_running = true;
+        render_thread = thread(&System::render_loop, this);
+        keyboard_thread = thread(&System::keyboard_loop, this);
+    }
+}
+
+// draw the cells that changed in the rows written since the last frame
+void System::render_frame() {
+    uint32_t rows = dirty_rows.exchange(0);
+    bool changed = false;
+    for(int row = 0; row < CONSOLE_ROWS; ++row) {
+        if (!(rows & (1<<row))) continue;
+        for(int col = 0; col < CONSOLE_COLS; ++col) {
+            int cell = row*CONSOLE_COLS + col;
+            uint16_t val = screen[cell].load(memory_order_relaxed);
+            if (val == drawn[cell]) continue;
+            drawn[cell] = val;
+            attron(val & ~0xff);
+            mvaddch(row, col, val & 0xff);
+            changed = true;
+        }
+    }
+    if (changed) refresh();
+}
+
+void System::render_loop() {
+    while (console_running) {
+        render_frame();
+        this_thread::sleep_for(chrono::milliseconds(1000/CONSOLE_FPS));
+    }
+}
+
+// reads stdin directly (the terminal is already in cbreak mode), so ncurses is only used by the render thread
+void System::keyboard_loop() {
+    while (console_running) {
+        pollfd pfd = { 0, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        char ch;
+        if (read(0, &ch, 1) != 1) continue;
+        unsigned tail = key_tail.load(memory_order_relaxed);
+        if (tail - key_head.load(memory_order_acquire) == KEY_QUEUE_SIZE) continue; // full, drop the key
+        key_queue[tail % KEY_QUEUE_SIZE] = ch;
+        key_tail.store(tail + 1, memory_order_release);
     }
 }
 
@@ -120,14 +229,19 @@ void System::tick(int clk) {
         return;
     }
 
-    if (ticks % (ps_per_clock * 1000) == 0) {
-        int ch = getch();
-        if (ch != ERR) {
-            if (!(interrupts & (1<<IRQ_KBD))) {
-                interrupts |= (1<<IRQ_KBD);
-                tx_queue.push_back(make_pair(IRQ_KBD,(int)IRQ));
-                keys.push(ch);
-            }
+    if (top->prof_commit) ++instructions;
+    if (profile_period) profile_tick();
+    if (energy_on) energy_tick();
+
+    // keys come from the keyboard thread; only look at the queue when the interrupt can be raised
+    if (!(interrupts & (1<<IRQ_KBD))) {
+        unsigned head = key_head.load(memory_order_relaxed);
+        if (head != key_tail.load(memory_order_acquire)) {
+            char ch = key_queue[head % KEY_QUEUE_SIZE];
+            key_head.store(head + 1, memory_order_release);
+            interrupts |= (1<<IRQ_KBD);
+            tx_queue.push_back(make_pair(IRQ_KBD,(int)IRQ));
+            keys.push(ch);
         }
     }
 
@@ -135,12 +249,12 @@ void System::tick(int clk) {
     if (!tx_queue.empty() && top->bus_respack) tx_queue.pop_front();
     if (!tx_queue.empty()) {
         top->bus_respcyc = 1;
-        top->bus_resp = tx_queue.begin()->first;
+        for(int i = 0; i < BUS_WORDS; ++i) set_bus_word(top->bus_resp, i, tx_queue.begin()->first.w[i]);
         top->bus_resptag = tx_queue.begin()->second;
         //cerr << "responding data " << top->bus_resp << " on tag " << std::hex << top->bus_resptag << endl;
     } else {
         top->bus_respcyc = 0;
-        top->bus_resp = 0xaaaaaaaaaaaaaaaaULL;
+        for(int i = 0; i < BUS_WORDS; ++i) set_bus_word(top->bus_resp, i, 0xaaaaaaaaaaaaaaaaULL);
         top->bus_resptag = 0xaaaa;
     }
 
@@ -149,21 +263,22 @@ void System::tick(int clk) {
         if (rx_count) {
             switch(cmd) {
             case MEMORY:
-                *((uint64_t*)(&ram[xfer_addr + (8-rx_count)*8])) = top->bus_req;
+                for(int i = 0; i < BUS_WORDS; ++i)
+                    *((uint64_t*)(&ram[xfer_addr + (LINE_BEATS-rx_count)*(BUS_WIDTH/8) + i*8])) = bus_word(top->bus_req, i);
                 break;
             case MMIO:
                 assert(xfer_addr < ramsize);
-                *((uint64_t*)(&ram[xfer_addr])) = top->bus_req;
+                *((uint64_t*)(&ram[xfer_addr])) = bus_word(top->bus_req, 0);
                 if (show_console)
                     if ((xfer_addr - 0xb8000) < 80*25*2) {
-                        int screenpos = xfer_addr - 0xb8000;
+                        // 4 cells per write, drawn by the render thread
+                        int cell = (xfer_addr - 0xb8000) / 2;
                         for(int shift = 0; shift < 8; shift += 2) {
-                            int val = (top->bus_req >> (8*shift)) & 0xffff;
+                            int val = (bus_word(top->bus_req, 0) >> (8*shift)) & 0xffff;
                             //cerr << "val=" << std::hex << val << endl;
-                            attron(val & ~0xff);
-                            mvaddch(screenpos / 160, screenpos % 160 + shift/2, val & 0xff);
+                            screen[cell + shift/2].store(val, memory_order_relaxed);
                         }
-                        refresh();
+                        dirty_rows |= (1 << (cell / CONSOLE_COLS)) | (1 << ((cell + 3) / CONSOLE_COLS));
                     }
                 break;
             }
@@ -173,7 +288,7 @@ void System::tick(int clk) {
 
         bool isWrite = ((top->bus_reqtag >> 12) & 1) == WRITE;
         if (cmd == MEMORY && isWrite)
-            rx_count = 8;
+            rx_count = LINE_BEATS;
         else if (cmd == MMIO && isWrite)
             rx_count = 1;
         else
@@ -181,7 +296,7 @@ void System::tick(int clk) {
 
         switch(cmd) {
         case MEMORY:
-            xfer_addr = top->bus_req & ~0x3fULL;
+            xfer_addr = bus_word(top->bus_req, 0) & ~0x3fULL;
             if (xfer_addr > (ramsize - 64)) {
                 cerr << "Invalid 64-byte access, address " << std::hex << xfer_addr << " is beyond end of memory at " << ramsize << endl;
                 Verilated::gotFinish(true);
@@ -192,12 +307,12 @@ void System::tick(int clk) {
                         dramsim->addTransaction(isWrite, xfer_addr)
                       );
                 //cerr << "add transaction " << std::hex << xfer_addr << " on tag " << top->bus_reqtag << endl;
-                if (!isWrite) addr_to_tag[xfer_addr] = make_pair(top->bus_req, top->bus_reqtag);
+                if (!isWrite) addr_to_tag[xfer_addr] = make_pair(bus_word(top->bus_req, 0), top->bus_reqtag);
             }
             break;
 
         case MMIO:
-            xfer_addr = top->bus_req;
+            xfer_addr = bus_word(top->bus_req, 0);
             assert(!(xfer_addr & 7));
             if (!isWrite) tx_queue.push_back(make_pair(*((uint64_t*)(&ram[xfer_addr])),top->bus_reqtag)); // hack - real I/O takes time
             break;
@@ -216,8 +331,15 @@ void System::dram_read_complete(unsigned id, uint64_t address, uint64_t clock_cy
     map<uint64_t, pair<uint64_t, int> >::iterator tag = addr_to_tag.find(address);
     assert(tag != addr_to_tag.end());
     uint64_t orig_addr = tag->second.first;
-    for(int i = 0; i < 64; i += 8)
-        tx_queue.push_back(make_pair(*((uint64_t*)(&ram[((orig_addr&(~63))+((orig_addr+i)&63))])),tag->second.second));
+    // the beat with the critical word goes first
+    int first = (orig_addr&63) / (BUS_WIDTH/8);
+    for(int i = 0; i < LINE_BEATS; ++i) {
+        bus_beat beat;
+        uint64_t base = (orig_addr&(~63)) + ((first+i)%LINE_BEATS)*(BUS_WIDTH/8);
+        for(int w = 0; w < BUS_WORDS; ++w)
+            beat.w[w] = *((uint64_t*)(&ram[base + w*8]));
+        tx_queue.push_back(make_pair(beat,tag->second.second));
+    }
     addr_to_tag.erase(tag);
 }
 
@@ -387,7 +509,255 @@ uint64_t System::load_elf(const char* filename) {
         // page-align max_elf_addr
         max_elf_addr = ((max_elf_addr + PAGE_SIZE-1) / PAGE_SIZE) * PAGE_SIZE;
     }
+    load_symbols(elf);
+
     // finalize
     close(fd);
     return elf_header.e_entry /* entry point */;
 }
+
+void System::load_symbols(Elf* elf) {
+    Elf_Scn* scn = NULL;
+    while((scn = elf_nextscn(elf, scn)) != NULL) {
+        GElf_Shdr shdr;
+        gelf_getshdr(scn, &shdr);
+        if (shdr.sh_type != SHT_SYMTAB) continue;
+
+        Elf_Data* data = elf_getdata(scn, NULL);
+        int count = shdr.sh_size / shdr.sh_entsize;
+        for(int i = 0; i < count; ++i) {
+            GElf_Sym sym;
+            gelf_getsym(data, i, &sym);
+            if (GELF_ST_TYPE(sym.st_info) != STT_FUNC) continue;
+            symbols.push_back({ sym.st_value, sym.st_size, elf_strptr(elf, shdr.sh_link, sym.st_name) });
+        }
+    }
+    sort(symbols.begin(), symbols.end(), [](const symbol& a, const symbol& b) { return a.addr < b.addr; });
+    func_profiles.assign(symbols.size()+1, func_profile());
+}
+
+// index into symbols, or symbols.size() if the pc isn't in any function
+int System::find_symbol(uint64_t pc) {
+    auto s = upper_bound(symbols.begin(), symbols.end(), pc, [](uint64_t pc, const symbol& s) { return pc < s.addr; });
+    if (s == symbols.begin()) return symbols.size();
+    --s;
+    if (s->size && pc >= s->addr + s->size) return symbols.size();
+    return s - symbols.begin();
+}
+
+void System::roi(const bool start) {
+    if (start && !roi_seen) {
+        // drop what was counted before the region of interest
+        profile_cycles = 0;
+        func_profiles.assign(symbols.size()+1, func_profile());
+        stack_samples.clear();
+        memset(events[1], 0, sizeof(events[1]));
+        memset(dram_energy[1], 0, sizeof(dram_energy[1]));
+    }
+    roi_seen = true;
+    roi_active = start;
+    cerr << "ROI " << (start ? "start" : "stop") << " at cycle " << std::dec << ticks/ps_per_clock << endl;
+}
+
+static const char* stall_names[4] = { "read", "jump", "mem", "ecall" };
+
+void System::profile_tick() {
+    // Keep a shadow call stack from the instructions written back:
+    // jal/jalr that link to ra or t0 are calls, jalr x0 through ra or t0 are returns.
+    if (top->prof_commit && top->prof_commit_pc != last_commit_pc) {
+        last_commit_pc = top->prof_commit_pc;
+        uint32_t instr = top->prof_commit_instr;
+        int opcode = instr & 0x7f;
+        int rd = (instr >> 7) & 0x1f;
+        int rs1 = (instr >> 15) & 0x1f;
+        if ((opcode == 0x6f || opcode == 0x67) && (rd == 1 || rd == 5)) {
+            if (call_stack.size() < 256) call_stack.push_back(find_symbol(last_commit_pc));
+        } else if (opcode == 0x67 && rd == 0 && (rs1 == 1 || rs1 == 5)) {
+            if (!call_stack.empty()) call_stack.pop_back();
+        }
+    }
+
+    if (!roi_active) return;
+    ++profile_cycles;
+
+    // misses are counted on every cycle, not only on samples
+    if (top->prof_imiss || top->prof_dmiss) {
+        func_profile& p = func_profiles[find_symbol(top->prof_pc)];
+        if (top->prof_imiss) ++p.imisses;
+        if (top->prof_dmiss) ++p.dmisses;
+    }
+
+    if (profile_cycles % profile_period) return;
+
+    int f = find_symbol(top->prof_pc);
+    func_profile& p = func_profiles[f];
+    ++p.samples;
+
+    string stack;
+    for(int caller : call_stack) {
+        stack += (caller < (int)symbols.size()) ? symbols[caller].name : "[unknown]";
+        stack += ';';
+    }
+    stack += (f < (int)symbols.size()) ? symbols[f].name : "[unknown]";
+    for(int i = 0; i < 4; ++i)
+        if (top->prof_stall & (1<<i)) {
+            ++p.stall_samples[i];
+            stack += string(";[") + stall_names[i] + " stall]";
+            break;
+        }
+    ++stack_samples[stack];
+}
+
+void System::profile_report() {
+    uint64_t total = 0;
+    vector<int> order;
+    for(int f = 0; f < (int)func_profiles.size(); ++f) {
+        total += func_profiles[f].samples;
+        if (func_profiles[f].samples || func_profiles[f].imisses || func_profiles[f].dmisses) order.push_back(f);
+    }
+    sort(order.begin(), order.end(), [this](int a, int b) { return func_profiles[a].samples > func_profiles[b].samples; });
+
+    cerr << "===== Profile: " << std::dec << profile_cycles << " cycles" << (roi_seen ? " in the region of interest" : "")
+         << ", one sample every " << profile_period << " cycles" << endl;
+    fprintf(stderr, "%7s %14s %6s %6s %6s %6s %10s %10s  %s\n",
+            "%time", "cycles", "read", "jump", "mem", "ecall", "I-misses", "D-misses", "function");
+    for(int f : order) {
+        const func_profile& p = func_profiles[f];
+        fprintf(stderr, "%6.2f%% %14llu", total ? 100.0*p.samples/total : 0.0, (unsigned long long)(p.samples*profile_period));
+        for(int i = 0; i < 4; ++i) // share of the function's samples stalled for each reason
+            fprintf(stderr, " %5.1f%%", p.samples ? 100.0*p.stall_samples[i]/p.samples : 0.0);
+        fprintf(stderr, " %10llu %10llu  %s\n", (unsigned long long)p.imisses, (unsigned long long)p.dmisses,
+                (f < (int)symbols.size()) ? symbols[f].name.c_str() : "[unknown]");
+    }
+
+    // collapsed stacks, one "caller;callee;... samples" line each (flamegraph.pl, speedscope)
+    const char* PROFILE_OUT = getenv("PROFILE_OUT");
+    ofstream folded(PROFILE_OUT ? PROFILE_OUT : "profile.folded");
+    for(auto& s : stack_samples)
+        folded << s.first << " " << s.second << endl;
+}
+
+void System::load_energy_table(const char* path) {
+    // one "event pJ" pair per line, # starts a comment
+    ifstream table(path);
+    if (!table) {
+        cerr << "Can't read energy table " << path << ", using the defaults" << endl;
+        return;
+    }
+    string line;
+    while (getline(table, line)) {
+        istringstream in(line.substr(0, line.find('#')));
+        string name;
+        double pj;
+        if (!(in >> name >> pj)) continue;
+        int i = find(event_names, event_names+NUM_EVENTS, name) - event_names;
+        if (i == NUM_EVENTS) cerr << "Unknown event " << name << " in " << path << endl;
+        else event_pj[i] = pj;
+    }
+}
+
+// register file reads and writes of a committed instruction, and the unit that ran it
+void System::instr_events(uint32_t instr, uint64_t* ev) {
+    int opcode = instr & 0x7f;
+    int rd = (instr >> 7) & 0x1f;
+    int funct3 = (instr >> 12) & 7;
+    int rs1 = (instr >> 15) & 0x1f;
+    int rs2 = (instr >> 20) & 0x1f;
+    bool reads_rs1 = true, reads_rs2 = false, writes_rd = true;
+    switch(opcode) {
+    case 0x33: case 0x3b: // OP, OP-32
+        reads_rs2 = true;
+        if ((instr >> 25) == 1) ++ev[funct3 < 4 ? EV_MUL : EV_DIV];
+        else ++ev[EV_ALU];
+        break;
+    case 0x23: case 0x63: // stores, branches
+        reads_rs2 = true;
+        writes_rd = false;
+        ++ev[EV_ALU];
+        break;
+    case 0x2f: // atomics
+        reads_rs2 = true;
+        ++ev[EV_ALU];
+        break;
+    case 0x37: case 0x17: case 0x6f: // lui, auipc, jal
+        reads_rs1 = false;
+        ++ev[EV_ALU];
+        break;
+    case 0x73: // ecalls are done by the host
+        reads_rs1 = false;
+        writes_rd = false;
+        break;
+    default: // loads, OP-IMM, jalr
+        ++ev[EV_ALU];
+        break;
+    }
+    ev[EV_RF_READ] += (reads_rs1 && rs1) + (reads_rs2 && rs2);
+    ev[EV_RF_WRITE] += writes_rd && rd;
+}
+
+// DRAMSim reports the average power (W) of each rank at the end of every epoch
+void System::dram_power(double background, double burst, double refresh, double actpre) {
+    if (sys->ticks != sys->dram_epoch_end) { // first rank of a new epoch
+        sys->dram_epoch_start = sys->dram_epoch_end;
+        sys->dram_epoch_end = sys->ticks;
+    }
+    double seconds = (sys->dram_epoch_end - sys->dram_epoch_start) * 1e-12;
+    double watts[4] = { background, burst, refresh, actpre };
+    for(int i = 0; i < 4; ++i) {
+        sys->dram_energy[0][i] += watts[i] * seconds;
+        if (sys->roi_active) sys->dram_energy[1][i] += watts[i] * seconds;
+    }
+}
+
+void System::energy_tick() {
+    uint64_t ev[NUM_EVENTS] = {0};
+    ev[EV_CYCLE] = 1;
+    if (top->prof_commit) {
+        ev[EV_INSTR] = 1;
+        instr_events(top->prof_commit_instr, ev);
+    }
+    int e = top->prof_events; // see top.sv
+    ev[EV_ICACHE_ACCESS] = e & 1;
+    ev[EV_DCACHE_ACCESS] = (e >> 1) & 1;
+    ev[EV_ICACHE_FILL] = (e >> 2) & 1;
+    ev[EV_DCACHE_FILL] = (e >> 3) & 1;
+    ev[EV_L2_ACCESS] = (e >> 4) & 15; // the L2 banks can all be busy at once
+    ev[EV_L2_FILL] = (e >> 8) & 15;
+    ev[EV_BUS_BEAT] = ((e >> 12) & 1) + ((e >> 13) & 1);
+    for(int i = 0; i < NUM_EVENTS; ++i) {
+        events[0][i] += ev[i];
+        if (roi_active) events[1][i] += ev[i];
+    }
+}
+
+static const char* dram_power_names[4] = { "background", "burst", "refresh", "act/pre" };
+
+void System::energy_report() {
+    // get the power of the last, partial epoch
+    if (ticks == dram_epoch_end) dram_epoch_start = ticks;
+    dramsim->printStats(true);
+
+    for(int r = 0; r < (roi_seen ? 2 : 1); ++r) {
+        const char* region = r ? "ROI" : "run";
+        uint64_t cycles = events[r][EV_CYCLE];
+        double seconds = cycles * ps_per_clock * 1e-12;
+        cerr << "===== Energy (" << region << "): " << std::dec << cycles << " cycles, "
+             << events[r][EV_INSTR] << " instructions" << endl;
+        fprintf(stderr, "%-16s %14s %10s %14s\n", "event", "count", "pJ each", "nJ");
+        double core = 0, dram = 0;
+        for(int i = 0; i < NUM_EVENTS; ++i) {
+            double pj = event_pj[i] * (i == EV_BUS_BEAT ? BUS_WORDS : 1);
+            double nj = events[r][i] * pj * 1e-3;
+            core += nj;
+            fprintf(stderr, "%-16s %14llu %10.2f %14.1f\n", event_names[i], (unsigned long long)events[r][i], pj, nj);
+        }
+        for(int i = 0; i < 4; ++i) {
+            double nj = dram_energy[r][i] * 1e9;
+            dram += nj;
+            fprintf(stderr, "dram_%-11s %14s %10s %14.1f\n", dram_power_names[i], "", "", nj);
+        }
+        double total = core + dram;
+        fprintf(stderr, "Energy (%s): %.1f nJ total (%.1f core, %.1f DRAM), %.3f mW average, %.4g J*s EDP\n",
+                region, total, core, dram, seconds ? total * 1e-6 / seconds : 0.0, total * 1e-9 * seconds);
+    }
+}
@@ -4,8 +4,13 @@
 #include <map>
 #include <list>
 #include <queue>
+#include <vector>
+#include <string>
 #include <utility>
 #include <bitset>
+#include <atomic>
+#include <thread>
+#include <libelf.h>
 #include "DRAMSim2/DRAMSim.h"
 #include "Vtop.h"
 
@@ -17,6 +22,16 @@
 #define VALID_PAGE_DIR  (0b0000000011)
 #define VALID_PAGE      (0b0000000001)
 
+// reserved system call to mark the region of interest: a0=1 starts it, a0=0 stops it
+#define ECALL_ROI       (1500)
+
+// bits per beat on the system bus; must match BUS_DATA_WIDTH of top.sv (the Makefile sets both)
+#ifndef BUS_WIDTH
+#define BUS_WIDTH       (64)
+#endif
+#define BUS_WORDS       (BUS_WIDTH/64)      // doublewords per beat
+#define LINE_BEATS      (512/BUS_WIDTH)     // beats per 64-byte line
+
 typedef unsigned long __uint64_t;
 typedef __uint64_t uint64_t;
 typedef unsigned int __uint32_t;
@@ -26,6 +41,15 @@ typedef __int32_t int32_t;
 typedef unsigned short __uint16_t;
 typedef __uint16_t uint16_t;
 
+// one beat of a response, word 0 in the low bits of bus_resp
+struct bus_beat {
+    uint64_t w[BUS_WORDS];
+    bus_beat(uint64_t v = 0) {
+        w[0] = v;
+        for(int i = 1; i < BUS_WORDS; ++i) w[i] = 0;
+    }
+};
+
 class System {
     Vtop* top;
 
@@ -36,9 +60,22 @@ class System {
 
     bool show_console;
 
+    // console: tick() only updates the shadow framebuffer, a thread draws it and another reads the keyboard
+    enum { CONSOLE_ROWS=25, CONSOLE_COLS=80, CONSOLE_FPS=30, KEY_QUEUE_SIZE=256 };
+    std::atomic<uint16_t> screen[CONSOLE_ROWS*CONSOLE_COLS]; // character and attribute, like the text buffer at 0xb8000
+    uint16_t drawn[CONSOLE_ROWS*CONSOLE_COLS]; // what the render thread last put on the terminal
+    std::atomic<uint32_t> dirty_rows; // one bit per row written since the last frame
+    char key_queue[KEY_QUEUE_SIZE]; // single producer (keyboard thread), single consumer (tick)
+    std::atomic<unsigned> key_head, key_tail;
+    std::atomic<bool> console_running;
+    std::thread render_thread, keyboard_thread;
+    void render_frame();
+    void render_loop();
+    void keyboard_loop();
+
     uint64_t load_elf(const char* filename);
 
-    list<pair<uint64_t, int> > tx_queue;
+    list<pair<bus_beat, int> > tx_queue;
     int cmd, rx_count;
     uint64_t xfer_addr;
     std::map<uint64_t, std::pair<uint64_t, int> > addr_to_tag;
@@ -54,6 +91,49 @@ class System {
     void load_segment(const int fd, const size_t memsz, const size_t filesz, uint64_t virt_addr);
 
     DRAMSim::MultiChannelMemorySystem* dramsim;
+
+    // sampling profiler, on with PROFILE=<cycles between samples>
+    struct symbol {
+        uint64_t addr, size;
+        std::string name;
+    };
+    struct func_profile {
+        uint64_t samples;
+        uint64_t stall_samples[4]; // read, jump, mem, ecall
+        uint64_t imisses, dmisses;
+    };
+    std::vector<symbol> symbols; // function symbols from .symtab, sorted by address
+    std::vector<func_profile> func_profiles; // one per symbol, plus one for pcs outside any symbol
+    std::map<std::string, uint64_t> stack_samples; // collapsed call stack -> samples
+    std::vector<int> call_stack; // functions that made the calls we are in (shadow stack)
+    uint64_t profile_period;
+    uint64_t profile_cycles; // cycles counted while in the region of interest
+    uint64_t last_commit_pc;
+    bool roi_active;
+    bool roi_seen;
+
+    void load_symbols(Elf* elf);
+    int find_symbol(uint64_t pc);
+    void profile_tick();
+    void profile_report();
+
+    // energy model, on with ENERGY=1 (per-event energies can be changed with ENERGY_TABLE=<file>)
+    enum {
+        EV_CYCLE, EV_INSTR, EV_RF_READ, EV_RF_WRITE, EV_ALU, EV_MUL, EV_DIV,
+        EV_ICACHE_ACCESS, EV_DCACHE_ACCESS, EV_ICACHE_FILL, EV_DCACHE_FILL, EV_L2_ACCESS, EV_L2_FILL, EV_BUS_BEAT,
+        NUM_EVENTS
+    };
+    bool energy_on;
+    double event_pj[NUM_EVENTS];
+    uint64_t events[2][NUM_EVENTS]; // whole run, region of interest
+    double dram_energy[2][4]; // joules: background, burst, refresh, activate/precharge
+    uint64_t dram_epoch_start, dram_epoch_end; // ticks of the last epoch DRAMSim reported power for
+
+    void load_energy_table(const char* path);
+    static void instr_events(uint32_t instr, uint64_t* ev);
+    static void dram_power(double background, double burst, double refresh, double actpre);
+    void energy_tick();
+    void energy_report();
     
 public:
     static System* sys;
@@ -61,10 +141,12 @@ public:
     uint64_t ecall_brk;
 
     uint64_t ticks;
+    uint64_t instructions; // committed by the core
     int ps_per_clock;
 
     void set_errno(const int new_errno);
     void invalidate(const uint64_t phys_addr);
+    void roi(const bool start);
     uint64_t virt_to_phy(const uint64_t virt_addr);
 
     char* ram;
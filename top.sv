@@ -4,8 +4,21 @@
 
 module top
 #(
-    BUS_DATA_WIDTH = 64,
+    BUS_DATA_WIDTH = 64, //system bus width: 64, 128, 256 or 512 (the L1s still talk to the pipeline 64 bits at a time)
     BUS_TAG_WIDTH = 13,
+    LINE_BEATS = 512 / BUS_DATA_WIDTH, //bus beats per 64-byte line
+    L2_ENABLE = 1, //set to 0 to connect the arbiter straight to the bus
+    EARLY_RESTART = 1, //set to 0 to make loads wait for the whole line from the D-cache
+    L1_LINES = 32, //lines in each L1 cache (power of two)
+    L1_TYPE = 1, //0 = direct-mapped L1s, 1 = 2-way set-associative
+    IF_PREFETCH = 1, //I-cache prefetcher, see cache.sv
+    MEM_PREFETCH = 2, //D-cache prefetcher, see cache.sv
+    L2_SETS = 64, //sets per L2 bank (power of two)
+    L2_WAYS = 4, //L2 associativity (power of two, at least 2)
+    ARB_POLICY = 0, //arbiter scheduling policy, see arbiter.sv
+    STORE_BUFFER = 4, //stores waiting to be written to the D-cache (0 = stores wait in MEM for the write)
+    SB_ENTRIES = STORE_BUFFER > 0 ? STORE_BUFFER : 1, //size of the store buffer arrays
+    FETCH_AHEAD = 1, //1 = fetch the next line while decode works through this one (0 = fetch at the end of each line)
     INIT=4'd0,
     FETCH=4'd1,
     WAIT=4'd2,
@@ -37,7 +50,17 @@ module top
     input  bus_respcyc, //it should become 1 if it is ready to respond.
     input  bus_reqack,
     input  [BUS_DATA_WIDTH-1:0] bus_resp, //the instruction read.
-    input  [BUS_TAG_WIDTH-1:0] bus_resptag
+    input  [BUS_TAG_WIDTH-1:0] bus_resptag,
+
+    // read by the profiler in system.cpp
+    output [63:0] prof_pc, // pc of the instruction in MEM
+    output [3:0] prof_stall, // {ecall, mem, jump, read} stalls
+    output prof_commit, // an instruction was written back
+    output [63:0] prof_commit_pc,
+    output [31:0] prof_commit_instr,
+    output prof_imiss, // demand misses in the I-cache and D-cache
+    output prof_dmiss,
+    output [13:0] prof_events // activity for the energy model, see System::energy_tick
 );
 
     logic [63:0] pc;
@@ -69,6 +92,8 @@ module top
     logic ecall_now;
     logic ecall_later;
     logic _ecall_later;
+    logic ecall_wait; // the host hasn't finished the system call yet
+    logic [63:0] ecall_ret;
     logic pending_write;
 
     //For jumps
@@ -76,8 +101,8 @@ module top
     reg _jumpbit;
     reg [31:0] jump_to_addr;
     reg [31:0] _jump_to_addr;
-    reg [3:0] index_from_pc;
-    reg [3:0] _index_from_pc;
+    reg [4:0] index_from_pc; // halfword of the line the jump target is at
+    reg [4:0] _index_from_pc;
 
     reg firstFETCH;
     reg _firstFETCH;
@@ -93,8 +118,14 @@ module top
 
     reg [3:0] state;
     reg [3:0] next_state;
-    reg [31:0] IF_instr;
+    reg [31:0] IF_instr; // compressed instructions are in the low 16 bits
     reg [31:0] _IF_instr;
+    logic [31:0] IF_instr_full; // IF_instr, expanded if it is compressed
+    logic [31:0] IF_expanded;
+    logic IF_rvc; // 1 if IF_instr is a compressed instruction
+    logic _IF_rvc;
+    logic [1:0] IF_step; // halfwords of the line IF_instr takes
+    logic [1:0] _IF_step;
     reg [4:0] fetch_count;
     reg [4:0] _fetch_count;
     reg getinstr_ready;
@@ -140,6 +171,8 @@ module top
     logic _ID_isW;
     logic [63:0] ID_pc;
     logic [63:0] _ID_pc;
+    logic ID_rvc; // 16-bit instruction, so the next one is at pc+2
+    logic _ID_rvc;
     //Valid instruction
     logic ID_valid_instr;
     logic _ID_valid_instr;
@@ -180,6 +213,8 @@ module top
     logic _RD_isW;
     logic [63:0] RD_pc;
     logic [63:0] _RD_pc;
+    logic RD_rvc;
+    logic _RD_rvc;
     //ECALL wires and registers
     logic [1:0] RD_ecall;
     logic [1:0] _RD_ecall;
@@ -210,6 +245,8 @@ module top
     logic [31:0] _EX_immediate;
     logic [63:0] EX_pc;
     logic [63:0] _EX_pc;
+    logic EX_rvc;
+    logic _EX_rvc;
     //ECALL wires and registers
     logic [1:0] EX_ecall;
     logic [1:0] _EX_ecall;
@@ -252,8 +289,54 @@ module top
     logic [63:0] MEM_str_value;
     logic [63:0] _MEM_str_value;
     logic [63:0] MEM_index_from_req;
+    logic MEM_early; // load only needs the doubleword at its address
+    //atomics (RV64A): the read-modify-write is done when the whole line is in
+    logic [63:0] MEM_amo_old; // the value in memory, sign extended for the .W forms
+    logic [63:0] MEM_amo_src; // rs2, sign extended the same way
+    logic [63:0] MEM_amo_value; // what the atomic writes to memory
+    logic [63:0] _MEM_amo_value;
+    logic MEM_amo_write; // 1 unless it is an LR or an SC that lost its reservation
+    logic _MEM_amo_write;
+    logic MEM_resv_set; // LR/SC reservation, kept in the D-cache
+    logic MEM_resv_clear;
+    logic MEM_cache_resv_valid;
+    logic [63:0] MEM_cache_resv_line;
     logic MEM_finished_instr;
     logic _MEM_finished_instr;
+    //loads: the line with the bytes still in the store buffer on top, and the value taken from it
+    logic [511:0] MEM_load_line;
+    logic [63:0] MEM_load_index;
+    logic [63:0] MEM_load_value;
+    logic [7:0] MEM_size_mask; // bytes of a doubleword the access touches
+    logic [127:0] MEM_load_mask; // bytes of the line the load needs
+    //store buffer: one entry per line (oldest first), with the bytes written so far.
+    //Stores retire into it and it is written to the D-cache whenever the MEM stage isn't using it.
+    logic [63:0] SB_addr[SB_ENTRIES-1:0]; // line address
+    logic [63:0] _SB_addr[SB_ENTRIES-1:0];
+    logic [511:0] SB_data[SB_ENTRIES-1:0];
+    logic [511:0] _SB_data[SB_ENTRIES-1:0];
+    logic [63:0] SB_mask[SB_ENTRIES-1:0]; // bytes of the line that were written
+    logic [63:0] _SB_mask[SB_ENTRIES-1:0];
+    logic [63:0] SB_pc[SB_ENTRIES-1:0]; // pc of the last store into the line, to train the D-cache prefetcher
+    logic [63:0] _SB_pc[SB_ENTRIES-1:0];
+    logic [7:0] SB_count;
+    logic [7:0] _SB_count;
+    logic [2:0] SB_status; // 0 idle, 1 reading the line, 2 request to write, 3 writing the line, 4 request to read
+    logic [2:0] _SB_status;
+    logic [8:0] SB_ptr;
+    logic [8:0] _SB_ptr;
+    logic [511:0] SB_line; // the line of the oldest entry, being written
+    logic [511:0] _SB_line;
+    logic SB_wait; // the MEM stage is done with the store buffer, or waits for it
+    logic SB_push; // a store goes in
+    logic [511:0] SB_push_data;
+    logic [63:0] SB_push_mask;
+    logic SB_drain_done; // the oldest entry is in the D-cache
+    logic [511:0] SB_fwd_data; // bytes of the line at EX_alu_result in the store buffer
+    logic [63:0] SB_fwd_mask;
+    logic SB_merge; // that line has an entry a store can go into
+    logic [7:0] SB_merge_index;
+    logic [7:0] SB_index; // entry the store from MEM goes into
     //Valid instruction
     logic MEM_valid_instr;
     logic _MEM_valid_instr;
@@ -273,6 +356,7 @@ module top
     logic [1:0] _WB_mem_access;
     logic [4:0] _WB_mem_size;
     logic [63:0] _WB_rs2_value;
+    logic [63:0] _WB_store_val; // value for do_pending_write
     //ECALL wires and registers
     logic [63:0] _WB_address;
     logic [1:0] _WB_ecall;
@@ -297,34 +381,42 @@ module top
     logic cache = 1;  //set to 0 to remove the cache, and comment out cache initialization block
     logic IF_cache_bus_reqcyc;
     logic IF_cache_bus_respack;
-    logic [BUS_DATA_WIDTH-1:0] IF_cache_bus_req;
+    logic [63:0] IF_cache_bus_req;
     logic [BUS_TAG_WIDTH-1:0] IF_cache_bus_reqtag;
     logic IF_cache_bus_respcyc;
     logic IF_cache_bus_reqack;
-    logic [BUS_DATA_WIDTH-1:0] IF_cache_bus_resp;
+    logic [63:0] IF_cache_bus_resp;
     logic [BUS_TAG_WIDTH-1:0] IF_cache_bus_resptag;
     logic [8:0] IF_cache_ptr;
     logic IF_cache_invalidated; // There's no use. just a place-holder.
-    logic [BUS_DATA_WIDTH-1:0] IF_cache_inv_req; // There's no use. just a place-holder.
+    logic [63:0] IF_cache_inv_req; // There's no use. just a place-holder.
 
     logic MEM_cache_bus_reqcyc;
     logic MEM_cache_bus_respack;
-    logic [BUS_DATA_WIDTH-1:0] MEM_cache_bus_req;
+    logic [63:0] MEM_cache_bus_req;
     logic [BUS_TAG_WIDTH-1:0] MEM_cache_bus_reqtag;
     logic MEM_cache_bus_respcyc;
     logic MEM_cache_bus_reqack;
-    logic [BUS_DATA_WIDTH-1:0] MEM_cache_bus_resp;
+    logic [63:0] MEM_cache_bus_resp;
     logic [BUS_TAG_WIDTH-1:0] MEM_cache_bus_resptag;
     logic [8:0] MEM_cache_ptr;
     logic MEM_cache_invalidated; // 1 means the cache line has been invalidated upon request.
     logic _MEM_cache_invalidated;
-    logic [BUS_DATA_WIDTH-1:0] MEM_cache_inv_req;
-
-    cache IF_cache_mod (
+    logic [63:0] MEM_cache_inv_req;
+    logic IF_cache_access; // lookups and line writes of both caches (for the energy model)
+    logic IF_cache_fill;
+    logic MEM_cache_access;
+    logic MEM_cache_fill;
+    logic IF_cache_pf_busy; // a prefetch is in flight (the arbiter isn't ready for an ecall)
+    logic MEM_cache_pf_busy;
+    logic [63:0] MEM_cache_req_pc; // pc of the instruction the D-cache request is for
+
+    cache #(.BUS_DATA_WIDTH(BUS_DATA_WIDTH), .NUM_CACHE_LINES(L1_LINES), .CACHE_TYPE(L1_TYPE), .PREFETCH(IF_PREFETCH)) IF_cache_mod (
         //INPUTS
-        .clk(clk),
+        .clk(clk), .reset(reset),
         .p_bus_reqcyc(IF_cache_bus_reqcyc), .p_bus_req(IF_cache_bus_req), 
         .p_bus_reqtag(IF_cache_bus_reqtag), .p_bus_respack(IF_cache_bus_respack),
+        .req_pc(pc),
         .m_bus_reqack(IF_arbiter_bus_reqack), .m_bus_respcyc(IF_arbiter_bus_respcyc), 
         .m_bus_resp(IF_arbiter_bus_resp), .m_bus_resptag(IF_arbiter_bus_resptag),
         .mem_ptr(IF_arbiter_ptr), .invalidated(IF_cache_invalidated),
@@ -334,13 +426,17 @@ module top
         .p_bus_resp(IF_cache_bus_resp), .p_bus_resptag(IF_cache_bus_resptag),
         .m_bus_reqcyc(IF_arbiter_bus_reqcyc), .m_bus_req(IF_arbiter_bus_req),
         .m_bus_reqtag(IF_arbiter_bus_reqtag), .m_bus_respack(IF_arbiter_bus_respack),
-        .out_ptr(IF_cache_ptr), .inv_req(IF_cache_inv_req)
+        .out_ptr(IF_cache_ptr), .inv_req(IF_cache_inv_req), .miss(prof_imiss),
+        .access(IF_cache_access), .fill(IF_cache_fill),
+        .pf_hold(ecall_stallstate != 0), .pf_busy(IF_cache_pf_busy),
+        .resv_set(1'b0), .resv_clear(1'b0), .resv_addr(64'h0), .resv_valid(), .resv_line()
     );
-    cache MEM_cache_mod (
+    cache #(.BUS_DATA_WIDTH(BUS_DATA_WIDTH), .NUM_CACHE_LINES(L1_LINES), .CACHE_TYPE(L1_TYPE), .PREFETCH(MEM_PREFETCH)) MEM_cache_mod (
         //INPUTS
-        .clk(clk),
+        .clk(clk), .reset(reset),
         .p_bus_reqcyc(MEM_cache_bus_reqcyc), .p_bus_req(MEM_cache_bus_req), 
         .p_bus_reqtag(MEM_cache_bus_reqtag), .p_bus_respack(MEM_cache_bus_respack),
+        .req_pc(MEM_cache_req_pc),
         .m_bus_reqack(MEM_arbiter_bus_reqack), .m_bus_respcyc(MEM_arbiter_bus_respcyc), 
         .m_bus_resp(MEM_arbiter_bus_resp), .m_bus_resptag(MEM_arbiter_bus_resptag),
         .mem_ptr(MEM_arbiter_ptr), .invalidated(_MEM_cache_invalidated),  
@@ -350,7 +446,11 @@ module top
         .p_bus_resp(MEM_cache_bus_resp), .p_bus_resptag(MEM_cache_bus_resptag),
         .m_bus_reqcyc(MEM_arbiter_bus_reqcyc), .m_bus_req(MEM_arbiter_bus_req),
         .m_bus_reqtag(MEM_arbiter_bus_reqtag), .m_bus_respack(MEM_arbiter_bus_respack),
-        .out_ptr(MEM_cache_ptr), .inv_req(MEM_cache_inv_req)
+        .out_ptr(MEM_cache_ptr), .inv_req(MEM_cache_inv_req), .miss(prof_dmiss),
+        .access(MEM_cache_access), .fill(MEM_cache_fill),
+        .pf_hold(ecall_stallstate != 0), .pf_busy(MEM_cache_pf_busy),
+        .resv_set(MEM_resv_set), .resv_clear(MEM_resv_clear), .resv_addr(_MEM_alu_result),
+        .resv_valid(MEM_cache_resv_valid), .resv_line(MEM_cache_resv_line)
     );
 
 
@@ -376,30 +476,106 @@ module top
     logic _arbiter_ready;
     logic arbiter_ready;
 
-    arbiter arbiter_mod (
+    //L2 variables (between the arbiter and the bus)
+    logic L2_bus_reqcyc;
+    logic L2_bus_respack;
+    logic [BUS_DATA_WIDTH-1:0] L2_bus_req;
+    logic [BUS_TAG_WIDTH-1:0] L2_bus_reqtag;
+    logic L2_bus_respcyc;
+    logic L2_bus_reqack;
+    logic [BUS_DATA_WIDTH-1:0] L2_bus_resp;
+    logic [BUS_TAG_WIDTH-1:0] L2_bus_resptag;
+    logic mem_bus_respack; // respack from the arbiter/L2 side
+    logic inv_respack; // respack for invalidations, from WB
+    logic _L2_ready;
+    logic [3:0] L2_access; // lookups in the L2 banks this cycle
+    logic [3:0] L2_fill;
+
+    arbiter #(.BUS_DATA_WIDTH(BUS_DATA_WIDTH), .POLICY(ARB_POLICY)) arbiter_mod (
         //INPUTS
-        .clk(clk),
+        .clk(clk), .reset(reset),
         .req0(IF_arbiter_bus_req), .reqcyc0(IF_arbiter_bus_reqcyc), .reqtag0(IF_arbiter_bus_reqtag), 
         .respack0(IF_arbiter_bus_respack),
         .req1(MEM_arbiter_bus_req), .reqcyc1(MEM_arbiter_bus_reqcyc), .reqtag1(MEM_arbiter_bus_reqtag), 
         .respack1(MEM_arbiter_bus_respack),
-        .bus_resp(bus_resp), .bus_respcyc(bus_respcyc), .bus_resptag(bus_resptag), .bus_reqack(bus_reqack),
+        .bus_resp(L2_bus_resp), .bus_respcyc(L2_bus_respcyc), .bus_resptag(L2_bus_resptag), .bus_reqack(L2_bus_reqack),
         
         //OUTPUTS
         .resp0(IF_arbiter_bus_resp), .respcyc0(IF_arbiter_bus_respcyc), 
         .resptag0(IF_arbiter_bus_resptag), .reqack0(IF_arbiter_bus_reqack),
         .resp1(MEM_arbiter_bus_resp), .respcyc1(MEM_arbiter_bus_respcyc), 
         .resptag1(MEM_arbiter_bus_resptag), .reqack1(MEM_arbiter_bus_reqack),
-        .bus_req(bus_req), .bus_reqcyc(bus_reqcyc), .bus_reqtag(bus_reqtag), .bus_respack(bus_respack),
+        .bus_req(L2_bus_req), .bus_reqcyc(L2_bus_reqcyc), .bus_reqtag(L2_bus_reqtag), .bus_respack(L2_bus_respack),
         .ptr0(IF_arbiter_ptr), .ptr1(MEM_arbiter_ptr), .ready(_arbiter_ready)
     );
 
+    generate
+        if(L2_ENABLE) begin : l2_gen
+            l2cache #(.BUS_DATA_WIDTH(BUS_DATA_WIDTH), .NUM_SETS(L2_SETS), .SET_INDEX($clog2(L2_SETS)),
+                      .NUM_WAYS(L2_WAYS), .WAY_BITS($clog2(L2_WAYS))) L2_cache_mod (
+                //INPUTS
+                .clk(clk), .reset(reset),
+                .p_bus_reqcyc(L2_bus_reqcyc), .p_bus_req(L2_bus_req), 
+                .p_bus_reqtag(L2_bus_reqtag), .p_bus_respack(L2_bus_respack),
+                .m_bus_reqack(bus_reqack), .m_bus_respcyc(bus_respcyc), 
+                .m_bus_resp(bus_resp), .m_bus_resptag(bus_resptag),
+
+                //OUTPUTS
+                .p_bus_reqack(L2_bus_reqack), .p_bus_respcyc(L2_bus_respcyc), 
+                .p_bus_resp(L2_bus_resp), .p_bus_resptag(L2_bus_resptag),
+                .m_bus_reqcyc(bus_reqcyc), .m_bus_req(bus_req),
+                .m_bus_reqtag(bus_reqtag), .m_bus_respack(mem_bus_respack),
+                .ready(_L2_ready), .access(L2_access), .fill(L2_fill)
+            );
+        end else begin : no_l2_gen
+            always_comb begin
+                bus_reqcyc = L2_bus_reqcyc;
+                bus_req = L2_bus_req;
+                bus_reqtag = L2_bus_reqtag;
+                mem_bus_respack = L2_bus_respack;
+                L2_bus_reqack = bus_reqack;
+                L2_bus_respcyc = bus_respcyc;
+                L2_bus_resp = bus_resp;
+                L2_bus_resptag = bus_resptag;
+                _L2_ready = 1;
+                L2_access = 0;
+                L2_fill = 0;
+            end
+        end
+    endgenerate
+
+    always_comb begin
+        bus_respack = mem_bus_respack || inv_respack;
+    end
+
     
     // FOR STORING INSTRS (total 16 (each 32 bits))
+    // With compressed instructions, instr_index counts halfwords (0-31).
     logic [31:0] instrlist[15:0];
     logic [31:0] _instrlist[15:0];
     logic [5:0] instr_index;
     logic [5:0] _instr_index;
+    logic pick; // take the instruction at _instr_index
+    logic [15:0] fetch_lo;
+    logic [15:0] fetch_hi;
+    logic carry_valid; // a 32-bit instruction started in the last halfword of the previous line
+    logic _carry_valid;
+    logic [15:0] carry_half;
+    logic [15:0] _carry_half;
+    // The line fetched ahead (FETCH_AHEAD): decode moves on to it without going through FETCH/WAIT,
+    // and so do jumps into it or into the current line.
+    logic [31:0] aheadlist[15:0];
+    logic [31:0] _aheadlist[15:0];
+    logic [63:0] ahead_addr;
+    logic [63:0] _ahead_addr;
+    logic ahead_valid; // aheadlist holds the line at ahead_addr
+    logic _ahead_valid;
+    logic [1:0] ahead_status; // 0 idle, 1 receiving the line, 2 last acknowledgement, 3 waiting for the request ack
+    logic [1:0] _ahead_status;
+    logic ahead_next; // aheadlist is the line after this one
+    logic ahead_switch; // decode moves on to the line fetched ahead this cycle
+    logic ahead_carry; // and the instruction it takes started in the last halfword of this line
+    logic [63:0] jump_line; // line of jump_to_addr
     
     always_comb begin
         if(cache == 1) begin
@@ -421,9 +597,23 @@ module top
             _firstFETCH = 0;
             _IF_pc = IF_pc;
             _IF_instr = IF_instr;
+            _IF_rvc = IF_rvc;
+            _IF_step = IF_step;
+            _carry_valid = carry_valid;
             _pc = pc;
             _fetch_count = fetch_count;
         end
+        pick = 0;
+        ahead_switch = 0;
+        ahead_carry = 0;
+        ahead_next = (FETCH_AHEAD == 1 && cache == 1 && ahead_valid && ahead_addr == pc + 64);
+        jump_line = jump_to_addr - jump_to_addr%64;
+        _ahead_status = ahead_status;
+        _ahead_addr = ahead_addr;
+        _ahead_valid = ahead_valid;
+        for (int i = 0; i < 16; i++) begin
+            _aheadlist[i] = aheadlist[i];
+        end
 
         case(state)
             INIT: begin
@@ -435,7 +625,11 @@ module top
                     end
                 end
             FETCH: begin
-                    if(cache == 1) begin
+                    if(ahead_status != 0) begin
+                        //a line fetched ahead is still coming in
+                        next_state = FETCH;
+                    end
+                    else if(cache == 1) begin
                         IF_cache_bus_reqcyc = 1;
                         IF_cache_bus_req = pc;
                         IF_cache_bus_reqtag = {1'b1,`SYSBUS_MEMORY,8'b0};
@@ -478,11 +672,12 @@ module top
                     end
                     else begin
                         if(IF_arbiter_bus_respcyc == 1) begin
-                            _instrlist[2*IF_arbiter_ptr] = IF_arbiter_bus_resp[31:0];
-                            _instrlist[2*IF_arbiter_ptr + 1] = IF_arbiter_bus_resp[63:32];
+                            for(int i = 0; i < BUS_DATA_WIDTH/32; i++) begin
+                                _instrlist[(BUS_DATA_WIDTH/32)*IF_arbiter_ptr + i] = IF_arbiter_bus_resp[32*i +: 32];
+                            end
                             IF_arbiter_bus_respack = 1;
                             next_state = WAIT;
-                            if(IF_arbiter_ptr == 7) begin
+                            if(IF_arbiter_ptr == LINE_BEATS-1) begin
                                 next_state = GETINSTR;
                                 _getinstr_ready = 1;
                             end
@@ -507,18 +702,33 @@ module top
                             _pc = jump_to_addr - jump_to_addr%64; //align by 64.
                             next_state = FETCH;
 
-                            //Clear the buffer.
-                            for (int i = 0; i < 16; i++) begin
-                                _instrlist[i] = 32'b0;
+                            if(FETCH_AHEAD == 1 && cache == 1 && jump_line == pc) begin
+                                //the target is in this line: start over in it
+                                next_state = GETINSTR;
+                            end
+                            else if(FETCH_AHEAD == 1 && cache == 1 && ahead_valid && jump_line == ahead_addr) begin
+                                //the target is in the line fetched ahead
+                                for (int i = 0; i < 16; i++) begin
+                                    _instrlist[i] = aheadlist[i];
+                                end
+                                next_state = GETINSTR;
+                            end
+                            else begin
+                                //Clear the buffer.
+                                for (int i = 0; i < 16; i++) begin
+                                    _instrlist[i] = 32'b0;
+                                end
                             end
           
                             _IF_instr = 0;
                             _instr_index = 0;
                             _IF_pc = 0;
                             _IF_valid_instr = 0; // INVALID //
+                            _carry_valid = 0;
 
-                            // In case getinstr_ready (fetched just before jump)
-                            _getinstr_ready = 0;
+                            // In case getinstr_ready (fetched just before jump),
+                            // or set to take the first instruction from a line that is already here
+                            _getinstr_ready = (next_state == GETINSTR);
                            
                             // stop stalling                      
                             _jump_stallstate = 0; 
@@ -538,39 +748,53 @@ module top
                         
                         //set this bit to 0 until fetch again.
                         _getinstr_ready = 0;
+                        pick = 1;
                       
                         if(jumpbit) begin
                             _jumpbit = 0;
                             _jump_to_addr = 0;
                             _index_from_pc = 0;
                             _instr_index = index_from_pc;
-                            _IF_pc = index_from_pc*4 + pc;
 
                             for (int i = 0; i < 32; i++) begin
                                 _writinglist[i] = 0;
                             end
+                        end else if(carry_valid) begin
+                            // The low half of this instruction was the last halfword of the previous line.
+                            _carry_valid = 0;
+                            _instr_index = 0;
+                            _IF_instr = {instrlist[0][15:0], carry_half};
+                            _IF_rvc = 0;
+                            _IF_step = 1; // only the high half is in this line
+                            _IF_pc = pc - 2;
+                            _IF_valid_instr = 1; // VALID //
+                            next_state = GETINSTR;
+                            pick = 0;
                         end else begin
                             //If not jumping then it should be fetching new instr. so index = 0.
                             _instr_index = 0;
-                            _IF_pc = pc;
-                        end
-                        _IF_instr = instrlist[_instr_index];
-                        _IF_valid_instr = 1; // VALID //
-                        next_state = GETINSTR;
-
-                        
-                        // The last instruction
-                        if(_IF_instr == 32'b0) begin
-                            _last_instr = {1'b0,IF_instr};
-                            _IF_valid_instr = 0; // INVALID //
-                            next_state = IDLE;
                         end
                     end
                     // instr_index = 1,2,... 
                     else begin
-                        _instr_index = instr_index + 1;
+                        _instr_index = instr_index + IF_step;
                         
-                        if(_instr_index >= 16) begin
+                        if(_instr_index >= 32 && ahead_next) begin
+                            //Go on with the line fetched ahead and take its first instruction now.
+                            _pc = pc + 64;
+                            for (int i = 0; i < 16; i++) begin
+                                _instrlist[i] = aheadlist[i];
+                            end
+                            _instr_index = 0;
+                            ahead_switch = 1;
+                            pick = 1;
+                        end else if(_instr_index >= 32 && ahead_status != 0 && ahead_addr == pc + 64) begin
+                            //The next line is on its way: wait for it.
+                            next_state = GETINSTR;
+                            _IF_instr = 0;
+                            _instr_index = instr_index;
+                            _IF_valid_instr = 0; // INVALID //
+                        end else if(_instr_index >= 32) begin
                             //Stall and go fetch more.
                             next_state = FETCH;
                             _pc = pc + 64;
@@ -579,18 +803,66 @@ module top
                             _IF_valid_instr = 0; // INVALID //
                               
                         end else begin
+                            pick = 1;
+                        end
+                    end
 
-                            _IF_instr = instrlist[_instr_index];
-                            _IF_valid_instr = 1; // VALID //
-                            _IF_pc = IF_pc + 4;
-                            next_state = GETINSTR;
+                    // Take the instruction that starts at halfword _instr_index of the line
+                    // (_instrlist and _pc, which is the line fetched ahead when decode moves on to it).
+                    if(pick) begin
+                        fetch_lo = _instr_index[0] ? _instrlist[_instr_index[4:1]][31:16] : _instrlist[_instr_index[4:1]][15:0];
+                        fetch_hi = _instr_index[0] ? _instrlist[_instr_index[4:1] + 4'd1][15:0] : _instrlist[_instr_index[4:1]][31:16];
+                        _IF_pc = _pc + 2*_instr_index;
+                        _IF_valid_instr = 1; // VALID //
+                        next_state = GETINSTR;
 
-                            // The last instruction
-                            if(_IF_instr == 32'b0) begin
-                                _last_instr = {1'b0,IF_instr}; //this is the instr before this.
-                                next_state = IDLE;
-                                _IF_valid_instr = 0; // INVALID //
+                        // The last instruction
+                        if(fetch_lo == 16'b0) begin
+                            _IF_instr = 0;
+                            _last_instr = {1'b0,IF_instr_full}; //this is the instr before this.
+                            next_state = IDLE;
+                            _IF_valid_instr = 0; // INVALID //
+                        end
+                        // Compressed: expanded in front of the decoder
+                        else if(fetch_lo[1:0] != 2'b11) begin
+                            _IF_instr = {16'b0, fetch_lo};
+                            _IF_rvc = 1;
+                            _IF_step = 1;
+                        end
+                        // A 32-bit instruction in the last halfword continues in the next line.
+                        else if(_instr_index == 31 && ahead_status != 0 && ahead_addr == _pc + 64) begin
+                            //wait for the next line
+                            _IF_instr = 0;
+                            _instr_index = instr_index;
+                            _IF_valid_instr = 0; // INVALID //
+                        end
+                        else if(_instr_index == 31 && ahead_next) begin
+                            //the next line was fetched ahead: put the instruction together now
+                            _carry_half = fetch_lo;
+                            _pc = pc + 64;
+                            for (int i = 0; i < 16; i++) begin
+                                _instrlist[i] = aheadlist[i];
                             end
+                            _IF_instr = {aheadlist[0][15:0], fetch_lo};
+                            _IF_rvc = 0;
+                            _IF_step = 1; // only the high half is in the new line
+                            _instr_index = 0;
+                            ahead_switch = 1;
+                            ahead_carry = 1;
+                        end
+                        else if(_instr_index == 31) begin
+                            _carry_valid = 1;
+                            _carry_half = fetch_lo;
+                            next_state = FETCH;
+                            _pc = pc + 64;
+                            _IF_instr = 0;
+                            _instr_index = 0;
+                            _IF_valid_instr = 0; // INVALID //
+                        end
+                        else begin
+                            _IF_instr = {fetch_hi, fetch_lo};
+                            _IF_rvc = 0;
+                            _IF_step = 2;
                         end
                     end
                 end
@@ -598,6 +870,49 @@ module top
                       $finish;
                   end
         endcase
+
+        // Fetch ahead: bring in the next line while the I-cache port is free,
+        // so decode doesn't wait for a FETCH at the end of this one.
+        if(FETCH_AHEAD == 1 && cache == 1) begin
+            case(ahead_status)
+                0: begin
+                        if(state == GETINSTR && next_state == GETINSTR && !getinstr_ready && !jumpbit
+                           && !(ahead_valid && ahead_addr == _pc + 64)) begin
+                            IF_cache_bus_reqcyc = 1;
+                            IF_cache_bus_req = _pc + 64;
+                            IF_cache_bus_reqtag = {1'b1,`SYSBUS_MEMORY,8'b0};
+                            _ahead_addr = _pc + 64;
+                            _ahead_valid = 0;
+                            //the cache acks a cycle after it takes the request, whatever fetch does by then
+                            _ahead_status = IF_cache_bus_reqack ? 1 : 3;
+                        end
+                    end
+                3: begin
+                        IF_cache_bus_reqcyc = 1;
+                        IF_cache_bus_req = ahead_addr;
+                        IF_cache_bus_reqtag = {1'b1,`SYSBUS_MEMORY,8'b0};
+                        if(IF_cache_bus_reqack) begin
+                            _ahead_status = 1;
+                        end
+                    end
+                1: begin
+                        if(IF_cache_bus_respcyc == 1) begin
+                            _aheadlist[2*IF_cache_ptr] = IF_cache_bus_resp[31:0];
+                            _aheadlist[2*IF_cache_ptr + 1] = IF_cache_bus_resp[63:32];
+                            IF_cache_bus_respack = 1;
+                            if(IF_cache_ptr == 7) begin
+                                _ahead_status = 2;
+                            end
+                        end
+                    end
+                2: begin
+                        //acknowledge the last beat again, like GETINSTR does after WAIT
+                        IF_cache_bus_respack = 1;
+                        _ahead_valid = 1;
+                        _ahead_status = 0;
+                    end
+            endcase
+        end
     end
 
     always_comb begin
@@ -627,8 +942,9 @@ module top
             _ID_valid_instr = IF_valid_instr; // For the next instruction.
 
             if(_ID_valid_instr) begin
-                _ID_instr = IF_instr;
+                _ID_instr = IF_instr_full;
                 _ID_pc = IF_pc;
+                _ID_rvc = IF_rvc;
     
                 if(_ID_isBranch == `COND || _ID_isBranch == `UNCOND) begin
                     //stall here.
@@ -665,6 +981,7 @@ module top
         _RD_isBranch = ID_isBranch;
         _RD_isW = ID_isW;
         _RD_pc = ID_pc;
+        _RD_rvc = ID_rvc;
 
         //If it's not the current instr that's writing to it, for rs1 or rs2, stall.
         if(writinglist[ID_rs1][32] && writinglist[ID_rs1][31:0] != ID_instr) begin
@@ -700,11 +1017,17 @@ module top
         _EX_immediate = RD_immediate;
         _EX_rs2_val = RD_rs2_val;
         _EX_pc = RD_pc;
+        _EX_rvc = RD_rvc;
 
         _EX_ecall = RD_ecall;
 
     
         // MEM stage.
+        MEM_resv_set = 0;
+        MEM_resv_clear = 0;
+        SB_push = 0;
+        _MEM_amo_value = MEM_amo_value;
+        _MEM_amo_write = MEM_amo_write;
        
         if(!MEM_stalled) begin
             _MEM_valid_instr = EX_valid_instr;
@@ -717,7 +1040,7 @@ module top
                 if(EX_alu_result) begin
                     _jumpbit = 1;  
                     _jump_to_addr = EX_immediate;
-                    _index_from_pc = (EX_immediate % 64)/4;
+                    _index_from_pc = (EX_immediate % 64)/2;
                     //Clear the buffer - Done in GETINSTR.
                 end else begin
                     // Not branching.
@@ -727,9 +1050,9 @@ module top
                 //Unconditional branch.
                 _jumpbit = 1;
                 _jump_to_addr = EX_alu_result;
-                _index_from_pc = (EX_alu_result % 64)/4;
+                _index_from_pc = (EX_alu_result % 64)/2;
                 // Should jump after WB... to store the addr to $rd.
-                _MEM_value = EX_pc + 4;
+                _MEM_value = EX_pc + (EX_rvc ? 2 : 4);
             end else begin
                 _MEM_value = EX_alu_result;
             end
@@ -757,17 +1080,90 @@ module top
 
                 _mem_stallstate = MEM;
 
+                // Loads that don't cross a doubleword go on as soon as the cache has that doubleword (early restart).
+                case(_MEM_size)
+                    `MEM_BYTE, `MEM_US_BYTE: MEM_early = 1;
+                    `MEM_HALF, `MEM_US_HALF: MEM_early = (_MEM_alu_result % 8) <= 6;
+                    `MEM_WORD, `MEM_US_WORD: MEM_early = (_MEM_alu_result % 8) <= 4;
+                    default: MEM_early = (_MEM_alu_result % 8) == 0;
+                endcase
+                MEM_early = MEM_early && EARLY_RESTART == 1 && cache == 1 && _MEM_access == `MEM_READ;
+
+                case(_MEM_size)
+                    `MEM_BYTE, `MEM_US_BYTE: MEM_size_mask = 8'h1;
+                    `MEM_HALF, `MEM_US_HALF: MEM_size_mask = 8'h3;
+                    `MEM_WORD, `MEM_US_WORD: MEM_size_mask = 8'hf;
+                    default: MEM_size_mask = 8'hff;
+                endcase
+                MEM_load_mask = {120'b0, MEM_size_mask} << (_MEM_alu_result % 64);
+
+                // The loaded value: the line read from memory with the bytes still in the store buffer on top.
+                // In status 0 nothing has been read yet, so it is only used when the store buffer has every byte.
+                MEM_load_line = MEM_read_value;
+                for (int b = 0; b < 64; b++) begin
+                    if(SB_fwd_mask[b]) begin
+                        MEM_load_line[8*b +: 8] = SB_fwd_data[8*b +: 8];
+                    end
+                end
+                MEM_load_index = (MEM_status == 0) ? _MEM_alu_result % 64 : MEM_index_from_req;
+                case(_MEM_size)
+                        `MEM_BYTE: MEM_load_value = {{56{MEM_load_line[8*MEM_load_index + 8 - 1]}}, 
+							MEM_load_line[8*MEM_load_index +: 8]};
+                        `MEM_HALF: MEM_load_value = {{48{MEM_load_line[8*MEM_load_index + 16 - 1]}}, 
+							MEM_load_line[8*MEM_load_index +: 16]};
+                        `MEM_WORD: MEM_load_value = {{32{MEM_load_line[8*MEM_load_index + 32 - 1]}}, 
+							MEM_load_line[8*MEM_load_index +: 32]};
+                        `MEM_US_BYTE: MEM_load_value = {56'b0, MEM_load_line[8*MEM_load_index +: 8]};
+                        `MEM_US_HALF: MEM_load_value = {48'b0, MEM_load_line[8*MEM_load_index +: 16]};
+                        `MEM_US_WORD: MEM_load_value = {32'b0, MEM_load_line[8*MEM_load_index +: 32]};
+                        default: MEM_load_value = {MEM_load_line[8*MEM_load_index +: 64]};
+                endcase
+
+                // With the store buffer, stores go into it and don't wait for the cache,
+                // loads that find all their bytes there don't go to the cache,
+                // other loads wait for a line being written to be done, and atomics for it to be empty.
+                SB_wait = 0;
+                if(STORE_BUFFER > 0 && cache == 1 && MEM_status == 0) begin
+                    if(_MEM_access == `MEM_WRITE) begin
+                        SB_wait = 1;
+                        if(SB_merge || SB_count < STORE_BUFFER) begin
+                            SB_push = 1;
+                            SB_push_data = {448'b0, _MEM_rs2_val} << (8*(_MEM_alu_result % 64));
+                            SB_push_mask = {56'b0, MEM_size_mask} << (_MEM_alu_result % 64);
+                            _MEM_value = _MEM_rs2_val; // for do_pending_write
+                            _mem_stallstate = 0;
+                        end
+                    end
+                    else if(_MEM_access == `MEM_ATOMIC) begin
+                        SB_wait = (SB_count != 0);
+                    end
+                    else if((MEM_load_mask & ~{64'b0, SB_fwd_mask}) == 0) begin
+                        SB_wait = 1;
+                        _MEM_value = MEM_load_value;
+                        _mem_stallstate = 0;
+                    end
+                    else begin
+                        SB_wait = (SB_status != 0);
+                    end
+                end
+
                 case(MEM_status)
-                    0: begin  //make request to memory to read
+                    0: if(!SB_wait) begin  //make request to memory to read
                             if(cache == 1) begin 
                                 MEM_cache_bus_reqcyc = 1;
-                                MEM_cache_bus_reqtag = {1'b1,`SYSBUS_MEMORY,8'b0};
-                                MEM_cache_bus_req = _MEM_alu_result - (_MEM_alu_result % 64); 
+                                if(MEM_early) begin
+                                    MEM_cache_bus_reqtag = {1'b1,`SYSBUS_MEMORY,`SYSBUS_EARLY};
+                                    MEM_cache_bus_req = _MEM_alu_result - (_MEM_alu_result % 8);
+                                end
+                                else begin
+                                    MEM_cache_bus_reqtag = {1'b1,`SYSBUS_MEMORY,8'b0};
+                                    MEM_cache_bus_req = _MEM_alu_result - (_MEM_alu_result % 64); 
+                                end
                                 if(MEM_cache_bus_reqack == 1) begin
                                     _MEM_status = 1;
                                     _MEM_read_value = 0;
                                     MEM_next_ptr = 0;
-                                    MEM_index_from_req = _MEM_alu_result - MEM_cache_bus_req;
+                                    MEM_index_from_req = _MEM_alu_result % 64;
                                 end
                             end
                             else begin
@@ -788,16 +1184,16 @@ module top
                                 if(MEM_cache_bus_respcyc == 1) begin
                                     _MEM_read_value[64*MEM_cache_ptr +: 64] = MEM_cache_bus_resp;
                                     MEM_cache_bus_respack = 1;
-                                    if(MEM_cache_ptr == 7) begin
+                                    if(MEM_cache_ptr == 7 || MEM_early) begin
                                         _MEM_status = 2;
                                     end
                                 end
                             end
                             else begin
                                 if(MEM_arbiter_bus_respcyc == 1) begin
-                                    _MEM_read_value[64*MEM_arbiter_ptr +: 64] = MEM_arbiter_bus_resp;
+                                    _MEM_read_value[BUS_DATA_WIDTH*MEM_arbiter_ptr +: BUS_DATA_WIDTH] = MEM_arbiter_bus_resp;
                                     MEM_arbiter_bus_respack = 1;
-                                    if(MEM_arbiter_ptr == 7) begin
+                                    if(MEM_arbiter_ptr == LINE_BEATS-1) begin
                                         _MEM_status = 2;
                                     end
                                 end
@@ -811,43 +1207,32 @@ module top
                             end
 
                             if(_MEM_access == `MEM_READ) begin //load
-                                //Load value from MEM_read_value to _MEM_value
-                                case(_MEM_size) 
-                                        `MEM_BYTE: _MEM_str_value = {{56{MEM_read_value[8*MEM_index_from_req + 8 - 1]}}, 
-									MEM_read_value[8*MEM_index_from_req +: 8]};
-                                        `MEM_HALF: _MEM_str_value = {{48{MEM_read_value[8*MEM_index_from_req + 16 - 1]}}, 
-									MEM_read_value[8*MEM_index_from_req +: 16]};
-                                        `MEM_WORD: _MEM_str_value = {{32{MEM_read_value[8*MEM_index_from_req + 32 - 1]}}, 
-									MEM_read_value[8*MEM_index_from_req +: 32]};
-                                        `MEM_DOUBLE: _MEM_str_value = {MEM_read_value[8*MEM_index_from_req +: 64]};
-                                        `MEM_US_BYTE: _MEM_str_value = {56'b0, MEM_read_value[8*MEM_index_from_req +: 8]};
-                                        `MEM_US_HALF: _MEM_str_value = {48'b0, MEM_read_value[8*MEM_index_from_req +: 16]};
-                                        `MEM_US_WORD: _MEM_str_value = {32'b0, MEM_read_value[8*MEM_index_from_req +: 32]};
-                                endcase
-                                
+                                _MEM_str_value = MEM_load_value;
                                 MEM_next_ptr = 0;
                                 _MEM_status = 4; 
                             end
-                            else if(_MEM_access == `MEM_WRITE) begin //store
-                                //modify _MEM_read_value using _MEM_rs2_val
-                                case(_MEM_size)
-                                    `MEM_BYTE: begin
-                                        _MEM_read_value[8*MEM_index_from_req +: 8] = _MEM_rs2_val[7:0];
-                                        _MEM_str_value = _MEM_rs2_val[7:0];
-                                    end
-                                    `MEM_HALF: begin
-                                        _MEM_read_value[8*MEM_index_from_req +: 16] = _MEM_rs2_val[15:0];
-                                        _MEM_str_value = _MEM_rs2_val[15:0];
-                                    end
-                                    `MEM_WORD: begin
-                                        _MEM_read_value[8*MEM_index_from_req +: 32] = _MEM_rs2_val[31:0];
-                                        _MEM_str_value = _MEM_rs2_val[31:0];
-                                    end
-                                    `MEM_DOUBLE: begin
-                                        _MEM_read_value[8*MEM_index_from_req +: 64] = _MEM_rs2_val;
-                                        _MEM_str_value = _MEM_rs2_val;
-                                    end
-                                endcase
+                            else if(_MEM_access == `MEM_WRITE || MEM_amo_write) begin //store, or an atomic that writes
+                                if(_MEM_access == `MEM_WRITE) begin
+                                    //modify _MEM_read_value using _MEM_rs2_val
+                                    case(_MEM_size)
+                                        `MEM_BYTE: begin
+                                            _MEM_read_value[8*MEM_index_from_req +: 8] = _MEM_rs2_val[7:0];
+                                            _MEM_str_value = _MEM_rs2_val[7:0];
+                                        end
+                                        `MEM_HALF: begin
+                                            _MEM_read_value[8*MEM_index_from_req +: 16] = _MEM_rs2_val[15:0];
+                                            _MEM_str_value = _MEM_rs2_val[15:0];
+                                        end
+                                        `MEM_WORD: begin
+                                            _MEM_read_value[8*MEM_index_from_req +: 32] = _MEM_rs2_val[31:0];
+                                            _MEM_str_value = _MEM_rs2_val[31:0];
+                                        end
+                                        `MEM_DOUBLE: begin
+                                            _MEM_read_value[8*MEM_index_from_req +: 64] = _MEM_rs2_val;
+                                            _MEM_str_value = _MEM_rs2_val;
+                                        end
+                                    endcase
+                                end
                                 //request to write to memory
                                 if(cache == 1) begin
                                     MEM_cache_bus_reqcyc = 1;
@@ -874,6 +1259,10 @@ module top
                                     end
                                 end
                             end
+                            else begin //LR, or an SC that lost its reservation: nothing to write
+                                MEM_next_ptr = 0;
+                                _MEM_status = 4;
+                            end
                         end
                     3: begin //write to memory
                             if(cache == 1) begin
@@ -891,10 +1280,10 @@ module top
                             else begin
                                 MEM_arbiter_bus_reqcyc = 1;
                                 MEM_arbiter_bus_reqtag = {1'b0,`SYSBUS_MEMORY,8'b0};
-                                MEM_arbiter_bus_req = MEM_read_value[64*MEM_ptr +: 64];
+                                MEM_arbiter_bus_req = MEM_read_value[BUS_DATA_WIDTH*MEM_ptr +: BUS_DATA_WIDTH];
                                 if(MEM_arbiter_bus_reqack == 1) begin
                                     MEM_next_ptr = MEM_ptr + 1;
-                                    if(MEM_ptr == 7) begin
+                                    if(MEM_ptr == LINE_BEATS-1) begin
                                         MEM_next_ptr = 0;
                                         _MEM_status = 4;
                                     end
@@ -911,6 +1300,58 @@ module top
                             MEM_index_from_req = 0;
                         end
                 endcase
+
+                // Atomics: once the whole line is in, work out the value for rd and what goes back to memory.
+                // This is done only here, so waiting for the write doesn't apply the operation twice.
+                if(_MEM_access == `MEM_ATOMIC && MEM_status == 1 && _MEM_status == 2) begin
+                    if(_MEM_size == `MEM_WORD) begin
+                        MEM_amo_old = {{32{_MEM_read_value[8*MEM_index_from_req + 31]}}, _MEM_read_value[8*MEM_index_from_req +: 32]};
+                        MEM_amo_src = {{32{_MEM_rs2_val[31]}}, _MEM_rs2_val[31:0]};
+                    end
+                    else begin
+                        MEM_amo_old = _MEM_read_value[8*MEM_index_from_req +: 64];
+                        MEM_amo_src = _MEM_rs2_val;
+                    end
+                    _MEM_str_value = MEM_amo_old;
+                    _MEM_amo_write = 1;
+
+                    // sign extended .W values compare the same way their low 32 bits do, signed or not
+                    case(_MEM_instr[31:27])
+                        `AMO_LR: begin
+                                _MEM_amo_write = 0;
+                                MEM_resv_set = 1;
+                            end
+                        `AMO_SC: begin
+                                _MEM_amo_write = (MEM_cache_resv_valid && MEM_cache_resv_line == _MEM_alu_result - (_MEM_alu_result % 64));
+                                _MEM_amo_value = MEM_amo_src;
+                                _MEM_str_value = _MEM_amo_write ? 0 : 1;
+                                MEM_resv_clear = 1;
+                            end
+                        `AMO_SWAP: _MEM_amo_value = MEM_amo_src;
+                        `AMO_ADD: _MEM_amo_value = MEM_amo_old + MEM_amo_src;
+                        `AMO_XOR: _MEM_amo_value = MEM_amo_old ^ MEM_amo_src;
+                        `AMO_AND: _MEM_amo_value = MEM_amo_old & MEM_amo_src;
+                        `AMO_OR: _MEM_amo_value = MEM_amo_old | MEM_amo_src;
+                        `AMO_MIN: _MEM_amo_value = ($signed(MEM_amo_old) < $signed(MEM_amo_src)) ? MEM_amo_old : MEM_amo_src;
+                        `AMO_MAX: _MEM_amo_value = ($signed(MEM_amo_old) > $signed(MEM_amo_src)) ? MEM_amo_old : MEM_amo_src;
+                        `AMO_MINU: _MEM_amo_value = (MEM_amo_old < MEM_amo_src) ? MEM_amo_old : MEM_amo_src;
+                        `AMO_MAXU: _MEM_amo_value = (MEM_amo_old > MEM_amo_src) ? MEM_amo_old : MEM_amo_src;
+                        default: _MEM_amo_write = 0;
+                    endcase
+
+                    if(_MEM_amo_write) begin
+                        if(_MEM_size == `MEM_WORD) begin
+                            _MEM_read_value[8*MEM_index_from_req +: 32] = _MEM_amo_value[31:0];
+                        end
+                        else begin
+                            _MEM_read_value[8*MEM_index_from_req +: 64] = _MEM_amo_value;
+                        end
+                    end
+                end
+            end
+            else if(STORE_BUFFER > 0 && SB_count != 0 && (_MEM_ecall != 0 || _MEM_instr[6:0] == 7'b0001111)) begin
+                //ecalls and fences wait for the stores to be in the cache
+                _mem_stallstate = MEM;
             end
             else begin
 
@@ -919,11 +1360,86 @@ module top
 
         end
 
+        // Store buffer: write the oldest line to the D-cache while the MEM stage isn't using it.
+        // Like a store without the buffer, it reads the line, puts the new bytes in and writes it back.
+        _SB_status = SB_status;
+        _SB_ptr = SB_ptr;
+        _SB_line = SB_line;
+        SB_drain_done = 0;
+        MEM_cache_req_pc = _MEM_pc;
+        if(STORE_BUFFER > 0 && cache == 1) begin
+            case(SB_status)
+                0: begin
+                        if(SB_count != 0 && MEM_status == 0 && !MEM_cache_bus_reqcyc) begin
+                            if(SB_mask[0] == {64{1'b1}}) begin
+                                //every byte was written, no need to read the line
+                                _SB_status = 2;
+                            end
+                            else begin
+                                MEM_cache_bus_reqcyc = 1;
+                                MEM_cache_bus_reqtag = {1'b1,`SYSBUS_MEMORY,8'b0};
+                                MEM_cache_bus_req = SB_addr[0];
+                                MEM_cache_req_pc = SB_pc[0];
+                                //the cache acks a cycle after it takes the request, keep it up until then
+                                _SB_status = MEM_cache_bus_reqack ? 1 : 4;
+                            end
+                        end
+                    end
+                4: begin
+                        MEM_cache_bus_reqcyc = 1;
+                        MEM_cache_bus_reqtag = {1'b1,`SYSBUS_MEMORY,8'b0};
+                        MEM_cache_bus_req = SB_addr[0];
+                        MEM_cache_req_pc = SB_pc[0];
+                        if(MEM_cache_bus_reqack == 1) begin
+                            _SB_status = 1;
+                        end
+                    end
+                1: begin
+                        if(MEM_cache_bus_respcyc == 1) begin
+                            _SB_line[64*MEM_cache_ptr +: 64] = MEM_cache_bus_resp;
+                            MEM_cache_bus_respack = 1;
+                            if(MEM_cache_ptr == 7) begin
+                                _SB_status = 2;
+                            end
+                        end
+                    end
+                2: begin
+                        //the last beat was acked in state 1, and a full line was never read
+                        for (int b = 0; b < 64; b++) begin
+                            if(SB_mask[0][b]) begin
+                                _SB_line[8*b +: 8] = SB_data[0][8*b +: 8];
+                            end
+                        end
+                        MEM_cache_bus_reqcyc = 1;
+                        MEM_cache_bus_reqtag = {1'b0,`SYSBUS_MEMORY,8'b0};
+                        MEM_cache_bus_req = SB_addr[0];
+                        MEM_cache_req_pc = SB_pc[0];
+                        if(MEM_cache_bus_reqack == 1) begin
+                            _SB_status = 3;
+                            _SB_ptr = 0;
+                        end
+                    end
+                3: begin
+                        MEM_cache_bus_reqcyc = 1;
+                        MEM_cache_bus_reqtag = {1'b0,`SYSBUS_MEMORY,8'b0};
+                        MEM_cache_bus_req = SB_line[64*SB_ptr +: 64];
+                        if(MEM_cache_bus_reqack == 1) begin
+                            _SB_ptr = SB_ptr + 1;
+                            if(SB_ptr == 7) begin
+                                _SB_status = 0;
+                                SB_drain_done = 1;
+                            end
+                        end
+                    end
+            endcase
+        end
+
         // WRITE BACK STAGE.
         _WB_valid_instr = MEM_valid_instr;
  	ecall_now = 0;
         pending_write = 0;
         MEM_cache_inv_req = 0;
+        inv_respack = 0;
         // NOTE: There shouldn't be any stall on WB. 
   
         if(ecall_later) begin
@@ -939,16 +1455,16 @@ module top
             if(bus_resptag == 12'h800 && bus_respcyc) begin
 	        
 		if(cache) begin
-                    MEM_cache_inv_req = bus_resp;
+                    MEM_cache_inv_req = bus_resp[63:0];
                     if(MEM_cache_invalidated) begin
-		        bus_respack = 1; 
+		        inv_respack = 1; 
                     end
                 end else begin
-                    bus_respack = 1;
+                    inv_respack = 1;
                 end
 
             end 
-            else begin 
+            else if(!ecall_wait) begin 
 	        _ecall_count = ecall_count - 1;
 
                 if(_ecall_count == 0) begin
@@ -956,6 +1472,8 @@ module top
                 end
             end
     
+            // a0 gets the result once the host is done with the call
+            _WB_a0 = WB_a0;
             _WB_write_reg = 10;
             _WB_write_val = WB_a0;
             _WB_write_sig = 1;
@@ -977,6 +1495,7 @@ module top
             _WB_ecall = MEM_ecall;
             _WB_mem_access = MEM_access;
             _WB_rs2_value = MEM_rs2_val;
+            _WB_store_val = MEM_value;
             _WB_address = MEM_alu_result;
             _WB_pc = MEM_pc;
             _WB_a0 = cur_a0;
@@ -1018,6 +1537,11 @@ module top
             if(_WB_mem_access == `MEM_WRITE) begin
                 pending_write = 1;
             end
+            else if(_WB_mem_access == `MEM_ATOMIC && MEM_amo_write) begin
+                // rd gets the old value, memory the new one
+                _WB_store_val = MEM_amo_value;
+                pending_write = 1;
+            end
 
             //This is for detecting the last instr.
             if(MEM_instr == last_instr[31:0])begin
@@ -1032,11 +1556,90 @@ module top
     end
 
 
+    // Store buffer lookup for the instruction in MEM: the bytes of its line that are still buffered
+    // (younger entries win), and the entry a store to that line can go into.
+    // The oldest entry can't take more bytes once it is being written to the cache.
+    always_comb begin
+        SB_fwd_data = 0;
+        SB_fwd_mask = 0;
+        SB_merge = 0;
+        SB_merge_index = 0;
+        for (int i = 0; i < SB_ENTRIES; i++) begin
+            if(i < SB_count && SB_addr[i] == EX_alu_result - (EX_alu_result % 64)) begin
+                for (int b = 0; b < 64; b++) begin
+                    if(SB_mask[i][b]) begin
+                        SB_fwd_data[8*b +: 8] = SB_data[i][8*b +: 8];
+                    end
+                end
+                SB_fwd_mask = SB_fwd_mask | SB_mask[i];
+                if(i != 0 || SB_status == 0) begin
+                    SB_merge = 1;
+                    SB_merge_index = i;
+                end
+            end
+        end
+    end
+
+    // Store buffer update: the oldest entry leaves once it is written, and a store
+    // from MEM goes into the entry for its line or a new one at the end.
+    always_comb begin
+        SB_index = SB_merge ? SB_merge_index : SB_count;
+        _SB_count = SB_count;
+        for (int i = 0; i < SB_ENTRIES; i++) begin
+            _SB_addr[i] = SB_addr[i];
+            _SB_data[i] = SB_data[i];
+            _SB_mask[i] = SB_mask[i];
+            _SB_pc[i] = SB_pc[i];
+        end
+        if(SB_drain_done) begin
+            for (int i = 0; i < SB_ENTRIES-1; i++) begin
+                _SB_addr[i] = SB_addr[i+1];
+                _SB_data[i] = SB_data[i+1];
+                _SB_mask[i] = SB_mask[i+1];
+                _SB_pc[i] = SB_pc[i+1];
+            end
+            _SB_count = SB_count - 1;
+            SB_index = SB_index - 1;
+        end
+        if(SB_push) begin
+            if(!SB_merge) begin
+                _SB_addr[SB_index] = _MEM_alu_result - (_MEM_alu_result % 64);
+                _SB_mask[SB_index] = 0;
+                _SB_count = _SB_count + 1;
+            end
+            for (int b = 0; b < 64; b++) begin
+                if(SB_push_mask[b]) begin
+                    _SB_data[SB_index][8*b +: 8] = SB_push_data[8*b +: 8];
+                end
+            end
+            _SB_mask[SB_index] = _SB_mask[SB_index] | SB_push_mask;
+            _SB_pc[SB_index] = _MEM_pc;
+        end
+    end
+
+    // For the profiler
+    always_comb begin
+        prof_pc = MEM_pc;
+        prof_stall = {ecall_stallstate != 0, mem_stallstate != 0, jump_stallstate != 0, read_stallstate != 0};
+        prof_commit = WB_valid_instr;
+        prof_commit_pc = WB_pc;
+        prof_commit_instr = WB_instr;
+        prof_events = {L2_bus_respcyc && L2_bus_respack, L2_bus_reqcyc && L2_bus_reqack, L2_fill, L2_access,
+                       MEM_cache_fill, IF_cache_fill, MEM_cache_access, IF_cache_access};
+    end
+
     // In Decode state
+    // compressed instructions are expanded to their 32-bit form in front of the decoder
+    rvc_expander rvc_expand_mod (.in(IF_instr[15:0]), .out(IF_expanded));
+
+    always_comb begin
+        IF_instr_full = IF_rvc ? IF_expanded : IF_instr;
+    end
+
     //instantiate decode modules for each instruction
     decoder instr_decode_mod (
                 //INPUTS
-                .clk(clk), .instruction(IF_instr), .cur_pc(IF_pc),
+                .clk(clk), .instruction(IF_instr_full), .cur_pc(IF_pc),
 
                 //OUTPUTS
                 .rd(_ID_rd), .rs1(_ID_rs1), .rs2(_ID_rs2), 
@@ -1084,17 +1687,27 @@ module top
     always_ff @ (posedge clk) begin
         if(reset) begin //when first starting.
             pc <= entry - entry%64;
-            index_from_pc <= (entry%64)/4;
+            index_from_pc <= (entry%64)/2;
             IF_pc <= entry;
             jumpbit <= 1;
             state <= INIT;
             IF_instr <= 64'h0;
+            IF_rvc <= 0;
+            IF_step <= 2;
+            carry_valid <= 0;
             fetch_count <= 0;
             instr_index <= 0;
             MEM_status <= 0;
             MEM_ptr <= 0;
             MEM_read_value <= -1;
+            MEM_amo_write <= 0;
+            SB_count <= 0;
+            SB_status <= 0;
+            SB_ptr <= 0;
             firstFETCH <= 1;
+            ahead_valid <= 0;
+            ahead_status <= 0;
+            ecall_wait <= 0;
             for (int i = 0; i < 16; i++) begin
                 instrlist[i] <= 32'b0;
             end  
@@ -1110,16 +1723,38 @@ module top
         ecall_count <= _ecall_count;
         ecall_later <= _ecall_later;
 
+        // The store buffer drains whatever the pipeline does
+        SB_count <= _SB_count;
+        SB_status <= _SB_status;
+        SB_ptr <= _SB_ptr;
+        SB_line <= _SB_line;
+        for (int i = 0; i < SB_ENTRIES; i++) begin
+            SB_addr[i] <= _SB_addr[i];
+            SB_data[i] <= _SB_data[i];
+            SB_mask[i] <= _SB_mask[i];
+            SB_pc[i] <= _SB_pc[i];
+        end
+
         // To avoid UNOPTFLAT
-        arbiter_ready <= _arbiter_ready;
+        arbiter_ready <= _arbiter_ready && _L2_ready && !IF_cache_pf_busy && !MEM_cache_pf_busy;
         MEM_cache_invalidated <= _MEM_cache_invalidated;
 
+        WB_a0 <= _WB_a0;
+        // The system call may still be running on the host after do_ecall_start returns (ASYNC_ECALL=1),
+        // so keep asking until it is done. The result is written to a0 in the ecall_count cycles after that.
         if (ecall_now) begin
-            do_ecall(_WB_a7, _WB_a0, _WB_a1, _WB_a2, _WB_a3, _WB_a4, _WB_a5, _WB_a6, _WB_a0);
+            do_ecall_start(_WB_a7, _WB_a0, _WB_a1, _WB_a2, _WB_a3, _WB_a4, _WB_a5, _WB_a6);
+            ecall_wait <= 1;
+        end
+        if (ecall_now || (ecall_wait && arbiter_ready)) begin
+            // invalidations from the call are only sent while the arbiter is free
+            if (do_ecall_done(ecall_ret) != 0) begin
+                WB_a0 <= ecall_ret;
+                ecall_wait <= 0;
+            end
         end
-        WB_a0 <= _WB_a0;
         if(pending_write) begin
-            do_pending_write(_WB_address,_WB_write_val, _WB_mem_size);
+            do_pending_write(_WB_address,_WB_store_val, _WB_mem_size);
         end
 
         for (int i = 0; i < 32; i++) begin
@@ -1129,6 +1764,8 @@ module top
         state <= next_state;
  
         pc <= _pc;
+        carry_valid <= _carry_valid;
+        carry_half <= _carry_half;
         fetch_count <= _fetch_count;
         getinstr_ready <= _getinstr_ready;
         last_instr <= _last_instr;
@@ -1140,11 +1777,17 @@ module top
         
         for (int i = 0; i < 16; i++) begin
             instrlist[i] <= _instrlist[i];
+            aheadlist[i] <= _aheadlist[i];
         end
+        ahead_addr <= _ahead_addr;
+        ahead_valid <= _ahead_valid;
+        ahead_status <= _ahead_status;
 
         // FETCH //
         if(_read_stallstate < GETINSTR && _jump_stallstate < GETINSTR && _mem_stallstate < GETINSTR && _ecall_stallstate < GETINSTR) begin
             IF_instr <= _IF_instr;
+            IF_rvc <= _IF_rvc;
+            IF_step <= _IF_step;
             instr_index <= _instr_index;
             IF_pc <= _IF_pc;
             
@@ -1154,6 +1797,12 @@ module top
             // Stalling
             IF_stalled <= 1;
             IF_valid_instr <= 0;
+            if(ahead_switch) begin
+                // pc and instrlist already moved on to the line fetched ahead:
+                // take its first instruction again once the stall is over
+                getinstr_ready <= 1;
+                carry_valid <= ahead_carry;
+            end
         end
     
         // DECODE //
@@ -1169,6 +1818,7 @@ module top
             ID_instr_type <= _ID_instr_type;
             ID_instr <= _ID_instr;
             ID_pc <= _ID_pc;
+            ID_rvc <= _ID_rvc;
             ID_mem_access <= _ID_mem_access;
             ID_mem_size <= _ID_mem_size;
             ID_ecall <= _ID_ecall;
@@ -1197,6 +1847,7 @@ module top
             RD_rs2_val <= _RD_rs2_val;
             RD_instr <= _RD_instr;
             RD_pc <= _RD_pc;
+            RD_rvc <= _RD_rvc;
             RD_mem_access <= _RD_mem_access;
             RD_mem_size <= _RD_mem_size;
 
@@ -1227,6 +1878,7 @@ module top
             EX_isBranch <= _EX_isBranch;
             EX_immediate <= _EX_immediate;
             EX_pc <= _EX_pc;
+            EX_rvc <= _EX_rvc;
             EX_ecall <= _EX_ecall;
 
             EX_stalled <= 0;
@@ -1244,6 +1896,8 @@ module top
             MEM_write_reg <= _MEM_write_reg;
             MEM_value <= _MEM_value; // This is the value that comes out from mem stage.
             MEM_str_value <= _MEM_str_value;
+            MEM_amo_value <= _MEM_amo_value;
+            MEM_amo_write <= _MEM_amo_write;
             MEM_write_sig <= _MEM_write_sig;
             MEM_status <= _MEM_status;
             MEM_instr <= _MEM_instr;
@@ -1271,6 +1925,8 @@ module top
                 MEM_read_value <= _MEM_read_value;
                 MEM_ptr <= MEM_next_ptr;
                 MEM_str_value <= _MEM_str_value;
+                MEM_amo_value <= _MEM_amo_value;
+                MEM_amo_write <= _MEM_amo_write;
                 MEM_finished_instr <= _MEM_finished_instr;
             end
 